@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "applog.h"
+
+#define MAX_THREADS 64
+#define MAX_PROCS 64
+#define RING_SIZE (1 << 20)
+
+static const char *level_names[] = {"none", "batch", "periodic"};
+
+struct config {
+    const char *path;
+    int threads, procs;
+    uint64_t per_thread;    // records each thread appends
+    size_t size;            // bytes per record, newline included
+    unsigned interval_ms;
+    int plain;              // one write() per record, as write_call.c does
+};
+
+struct writer {
+    const struct config *cfg;
+    struct applog *log;
+    int fd, durability;
+    int id;
+    uint64_t *lat;          // per_thread latencies in ns, in shared memory
+    pthread_t thread;
+};
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Without the log: one O_APPEND write() per record, plus fdatasync() for "batch"
+static int plain_append(int fd, int durability, const char *rec, size_t len) {
+    if (write(fd, rec, len) != (ssize_t)len)
+        return -1;
+    return durability == APPLOG_BATCH ? fdatasync(fd) : 0;
+}
+
+static void *writer_thread(void *arg) {
+    struct writer *w = arg;
+    const struct config *cfg = w->cfg;
+    char *rec = malloc(cfg->size);
+    if (rec == NULL)
+        fail("malloc");
+    for (uint64_t i = 0; i < cfg->per_thread; i++) {
+        // "writer seq xxxx...\n", padded to the record size
+        memset(rec, 'x', cfg->size);
+        int n = snprintf(rec, cfg->size, "%d %" PRIu64 " ", w->id, i);
+        if (n > 0 && (size_t)n < cfg->size)
+            rec[n] = 'x';
+        rec[cfg->size - 1] = '\n';
+        uint64_t t0 = now_ns();
+        int r = cfg->plain ? plain_append(w->fd, w->durability, rec, cfg->size)
+                           : applog_append(w->log, rec, cfg->size);
+        if (r == -1)
+            fail("append");
+        w->lat[i] = now_ns() - t0;
+    }
+    free(rec);
+    return NULL;
+}
+
+// One process: cfg->threads writers, ids from first_id
+static void run_threads(const struct config *cfg, struct applog *log, int fd, int durability, int first_id,
+                        uint64_t *lat) {
+    struct writer w[MAX_THREADS];
+    for (int i = 0; i < cfg->threads; i++) {
+        w[i].cfg = cfg;
+        w[i].log = log;
+        w[i].fd = fd;
+        w[i].durability = durability;
+        w[i].id = first_id + i;
+        w[i].lat = lat + (uint64_t)w[i].id * cfg->per_thread;
+        if (pthread_create(&w[i].thread, NULL, writer_thread, &w[i]) != 0)
+            fail("pthread_create");
+    }
+    for (int i = 0; i < cfg->threads; i++)
+        pthread_join(w[i].thread, NULL);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_level(const struct config *cfg, int durability) {
+    uint64_t total = (uint64_t)cfg->procs * cfg->threads * cfg->per_thread;
+    uint64_t *lat = mmap(NULL, total * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                         -1, 0);
+    if (lat == MAP_FAILED)
+        fail("mmap");
+    if (truncate(cfg->path, 0) == -1 && errno != ENOENT)
+        fail(cfg->path);
+
+    struct applog log;
+    int fd = -1;
+    if (cfg->plain) {
+        fd = open(cfg->path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd == -1)
+            fail(cfg->path);
+    } else if (applog_open(&log, cfg->path, durability, cfg->interval_ms, RING_SIZE) == -1) {
+        fail(cfg->path);
+    }
+
+    uint64_t t0 = now_ns();
+    if (cfg->procs == 1) {
+        run_threads(cfg, &log, fd, durability, 0, lat);
+    } else {
+        pid_t pids[MAX_PROCS];
+        for (int p = 0; p < cfg->procs; p++) {
+            pids[p] = fork();
+            if (pids[p] == -1)
+                fail("fork");
+            if (pids[p] == 0) {
+                run_threads(cfg, &log, fd, durability, p * cfg->threads, lat);
+                if (!cfg->plain)
+                    applog_close(&log);
+                _exit(0);
+            }
+        }
+        for (int p = 0; p < cfg->procs; p++) {
+            int status;
+            if (waitpid(pids[p], &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                fprintf(stderr, "writer process failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+    }
+    double secs = (now_ns() - t0) / 1e9;
+
+    uint64_t batches = 0, syncs = 0;
+    if (cfg->plain) {
+        batches = total;
+        syncs = durability == APPLOG_BATCH ? total : 0;
+        if (durability == APPLOG_PERIODIC && fdatasync(fd) == -1)
+            fail("fdatasync");
+        close(fd);
+    } else {
+        batches = log.shm->batches;
+        syncs = log.shm->syncs;
+        if (applog_close(&log) == -1)
+            fail("close");
+    }
+
+    // Every record must have landed whole
+    struct stat st;
+    if (stat(cfg->path, &st) == -1)
+        fail(cfg->path);
+    int ok = (uint64_t)st.st_size == total * cfg->size;
+
+    qsort(lat, total, sizeof(uint64_t), cmp_u64);
+    printf("%-8s %-6s %10.0f rec/s %8.1f MiB/s  p50 %8.1f us  p99 %8.1f us  max %8.1f us  "
+           "%" PRIu64 " writes %" PRIu64 " syncs%s\n",
+           level_names[durability], cfg->plain ? "plain" : "group", total / secs,
+           total * cfg->size / secs / 1048576.0, lat[total / 2] / 1e3, lat[total * 99 / 100] / 1e3,
+           lat[total - 1] / 1e3, batches, syncs, ok ? "" : "  SIZE MISMATCH");
+    munmap(lat, total * sizeof(uint64_t));
+    if (!ok)
+        exit(EXIT_FAILURE);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-d none|batch|periodic] [-i ms] [-t threads] [-p procs] [-n records] "
+                    "[-s size] [-u] <log_file>\n", prog);
+    fprintf(stderr, "  -d  durability level (default: run all three)\n");
+    fprintf(stderr, "  -i  sync interval for periodic (default 100 ms)\n");
+    fprintf(stderr, "  -n  records per thread (default 10000)\n");
+    fprintf(stderr, "  -s  record size in bytes, newline included (default 64)\n");
+    fprintf(stderr, "  -u  also run without the log: one write() per record\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct config cfg = {NULL, 4, 1, 10000, 64, 100, 0};
+    int level = -1, unbatched = 0, opt;
+    while ((opt = getopt(argc, argv, "d:i:n:p:s:t:u")) != -1) {
+        switch (opt) {
+        case 'd':
+            for (level = 2; level >= 0 && strcmp(optarg, level_names[level]) != 0; level--)
+                ;
+            if (level < 0)
+                usage(argv[0]);
+            break;
+        case 'i':
+            cfg.interval_ms = atoi(optarg);
+            break;
+        case 'n':
+            cfg.per_thread = strtoull(optarg, NULL, 0);
+            break;
+        case 'p':
+            cfg.procs = atoi(optarg);
+            break;
+        case 's':
+            cfg.size = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 'u':
+            unbatched = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || cfg.threads < 1 || cfg.threads > MAX_THREADS || cfg.procs < 1 ||
+        cfg.procs > MAX_PROCS || cfg.per_thread == 0 || cfg.size < 2 || cfg.size > RING_SIZE / 2 ||
+        cfg.interval_ms == 0)
+        usage(argv[0]);
+    cfg.path = argv[optind];
+
+    printf("%d process(es) x %d thread(s) x %" PRIu64 " records of %zu bytes\n", cfg.procs, cfg.threads,
+           cfg.per_thread, cfg.size);
+    for (int d = 0; d < 3; d++) {
+        if (level != -1 && d != level)
+            continue;
+        cfg.plain = 0;
+        run_level(&cfg, d);
+        if (unbatched) {
+            cfg.plain = 1;
+            run_level(&cfg, d);
+        }
+    }
+    return 0;
+}
+
+/*Explanation:
+Build: gcc -O2 applog.c -o applog -lpthread
+
+Usage: ./applog log.txt                        (4 threads, all three durability levels)
+       ./applog -p 4 -t 2 -d batch -u log.txt   (4 processes of 2 threads, compared with plain writes)
+
+write_call.c appends one line per run with an O_APPEND write(). That is fine for one line, but
+every record costs a system call, and making each one durable costs an fdatasync(), which waits
+for the disk. applog.h lets writers share the cost: records are copied into a ring in shared
+memory and whichever writer finds no flush running writes everything queued so far with one
+writev() (and, at the "batch" level, one fdatasync()). Writers arriving during that flush are
+carried by the next one, so the slower the disk, the bigger the batches.
+
+Each line of output is one run: records per second, append latency (median, 99th percentile,
+worst) measured around every single append, and how many writes and syncs it took. With -u the
+same records are also written the write_call.c way for comparison. Each record is
+"<writer> <seq> xxx...\n", so the log can be checked with sort and uniq.*/
@@ -0,0 +1,291 @@
+/*
+ * Append-only log with group commit, shared by threads and forked processes.
+ *
+ * write_call.c appends with one O_APPEND write() per record. With many
+ * writers that is one system call (and, if the data must be durable, one
+ * fdatasync()) per record. Here writers instead copy their record into a
+ * ring buffer in shared memory (MAP_SHARED | MAP_ANONYMOUS, so it is
+ * inherited across fork()). Whoever finds no flush in progress becomes
+ * the leader. The leader takes everything in the ring, writes it with a
+ * single writev() (two iovecs when the batch wraps around the end of the
+ * ring), and wakes the writers whose records went out. Records that
+ * arrive during a flush form the next batch, so under load one system
+ * call carries many records.
+ *
+ * Durability:
+ *   APPLOG_NONE      append returns once the record is written (page cache)
+ *   APPLOG_BATCH     the leader fdatasync()s each batch before waking anyone
+ *   APPLOG_PERIODIC  like NONE, plus a thread of the opening process that
+ *                    fdatasync()s every interval_ms
+ *
+ * The mutex and condition variable are PTHREAD_PROCESS_SHARED. The mutex
+ * is robust, so a process that dies holding it does not hang the others.
+ * A leader writes with the mutex released, but holds a second robust
+ * mutex for as long as its flush runs. Writers waiting on a flush wake
+ * every APPLOG_LEADER_CHECK_MS and try that mutex: EOWNERDEAD means the
+ * leader died (even if it is an unreaped zombie, which kill() would still
+ * find), so one of them cuts the file back to where that batch began and
+ * flushes it again. This assumes nothing else appends to the file while
+ * the log is open.
+ * Call applog_open() before fork() and applog_close() once in every process.
+ * Records are written exactly as given: include your own newline or framing.
+ */
+#ifndef APPLOG_H
+#define APPLOG_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define APPLOG_LEADER_CHECK_MS 100 // how often waiters check that the leader is alive
+
+enum { APPLOG_NONE, APPLOG_BATCH, APPLOG_PERIODIC };
+
+// Lives in shared memory, followed by the ring itself
+struct applog_shm {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;    // "a flush finished": written bytes and free space changed
+    uint64_t tail;          // bytes ever copied into the ring
+    uint64_t head;          // bytes ever written to the file; ring holds [head, tail)
+    pthread_mutex_t flush_lock; // held by that leader until its flush is done
+    int flushing;           // a leader is writing [head, some end)
+    uint64_t file_size;     // bytes in the file before that batch
+    int error;              // sticky errno of a failed write or sync
+    uint64_t batches;       // writev() calls
+    uint64_t records;
+    uint64_t syncs;         // fdatasync() calls
+    char ring[];
+};
+
+struct applog {
+    int fd;
+    int durability;
+    unsigned interval_ms;
+    size_t ring_size;
+    struct applog_shm *shm;
+    pid_t owner;            // process that opened the log and runs the periodic syncer
+    int stop;
+    pthread_t syncer;
+};
+
+static inline void applog_lock(struct applog_shm *s) {
+    // A writer died in the middle: the ring indexes are only updated
+    // together under the lock, so the state is still consistent
+    if (pthread_mutex_lock(&s->lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&s->lock);
+}
+
+// Called with the lock held; returns with it held. Writes [head, tail) as one batch.
+static inline void applog_flush_locked(struct applog *log) {
+    struct applog_shm *s = log->shm;
+    uint64_t start = s->head, end = s->tail;
+    // Free: a dead leader's hold was already recovered before 'flushing' was cleared
+    if (pthread_mutex_lock(&s->flush_lock) == EOWNERDEAD)
+        pthread_mutex_consistent(&s->flush_lock);
+    s->flushing = 1;
+    pthread_mutex_unlock(&s->lock);
+
+    // Bytes [start, end) are stable: writers only add beyond tail, and
+    // nobody reuses them until head moves past
+    struct iovec iov[2];
+    size_t off = start % log->ring_size, len = end - start;
+    size_t first = len < log->ring_size - off ? len : log->ring_size - off;
+    iov[0].iov_base = s->ring + off;
+    iov[0].iov_len = first;
+    iov[1].iov_base = s->ring;
+    iov[1].iov_len = len - first;
+    int iovcnt = len > first ? 2 : 1, err = 0;
+    while (iovcnt > 0 && iov[iovcnt - 1].iov_len > 0) {
+        ssize_t n = writev(log->fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            err = errno;
+            break;
+        }
+        // Partial write: drop what went out and go again
+        while (n > 0 && iovcnt > 0) {
+            size_t k = (size_t)n < iov[0].iov_len ? (size_t)n : iov[0].iov_len;
+            iov[0].iov_base = (char *)iov[0].iov_base + k;
+            iov[0].iov_len -= k;
+            n -= k;
+            if (iov[0].iov_len == 0) {
+                iov[0] = iov[1];
+                iovcnt--;
+            }
+        }
+    }
+    if (err == 0 && log->durability == APPLOG_BATCH && fdatasync(log->fd) == -1)
+        err = errno;
+
+    applog_lock(s);
+    if (err != 0)
+        s->error = err;
+    s->file_size += end - start;
+    s->batches++;
+    if (log->durability == APPLOG_BATCH)
+        s->syncs++;
+    s->head = end;
+    s->flushing = 0;
+    pthread_mutex_unlock(&s->flush_lock);
+    pthread_cond_broadcast(&s->cond);
+}
+
+// Called with the lock held while another leader flushes; returns with it held. If that
+// leader died mid-write, nobody would ever clear 'flushing': drop whatever part of its batch
+// reached the file and clear it, so the caller leads the batch again.
+static inline void applog_wait_locked(struct applog *log) {
+    struct applog_shm *s = log->shm;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += APPLOG_LEADER_CHECK_MS * 1000000L;
+    ts.tv_sec += ts.tv_nsec / 1000000000L;
+    ts.tv_nsec %= 1000000000L;
+    if (pthread_cond_timedwait(&s->cond, &s->lock, &ts) == EOWNERDEAD)
+        pthread_mutex_consistent(&s->lock);
+    // The leader holds flush_lock until it clears 'flushing' (under the lock we hold now),
+    // so while 'flushing' is set the trylock only succeeds if the holder is gone
+    if (s->flushing && pthread_mutex_trylock(&s->flush_lock) == EOWNERDEAD) {
+        pthread_mutex_consistent(&s->flush_lock);
+        pthread_mutex_unlock(&s->flush_lock);
+        if (ftruncate(log->fd, s->file_size) == -1 && s->error == 0)
+            s->error = errno;
+        s->flushing = 0;
+    }
+}
+
+// Append one record; returns after it has been written (and synced, for APPLOG_BATCH)
+static inline int applog_append(struct applog *log, const void *rec, size_t len) {
+    struct applog_shm *s = log->shm;
+    if (len > log->ring_size / 2) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    applog_lock(s);
+    // Wait for room; if nobody is flushing, free it ourselves
+    while (s->tail - s->head + len > log->ring_size && s->error == 0) {
+        if (!s->flushing)
+            applog_flush_locked(log);
+        else
+            applog_wait_locked(log);
+    }
+    if (s->error != 0) {
+        errno = s->error;
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    size_t off = s->tail % log->ring_size;
+    size_t first = len < log->ring_size - off ? len : log->ring_size - off;
+    memcpy(s->ring + off, rec, first);
+    memcpy(s->ring, (const char *)rec + first, len - first);
+    s->tail += len;
+    s->records++;
+    uint64_t mine = s->tail;
+
+    // Group commit: lead a flush if none is running, else ride along with the next one
+    while (s->head < mine && s->error == 0) {
+        if (!s->flushing)
+            applog_flush_locked(log);
+        else
+            applog_wait_locked(log);
+    }
+    int err = s->error;
+    pthread_mutex_unlock(&s->lock);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void *applog_syncer(void *arg) {
+    struct applog *log = arg;
+    struct timespec ts = {log->interval_ms / 1000, (log->interval_ms % 1000) * 1000000L};
+    while (!__atomic_load_n(&log->stop, __ATOMIC_ACQUIRE)) {
+        nanosleep(&ts, NULL);
+        int r = fdatasync(log->fd);
+        applog_lock(log->shm);
+        log->shm->syncs++;
+        if (r == -1 && log->shm->error == 0)
+            log->shm->error = errno;
+        pthread_mutex_unlock(&log->shm->lock);
+    }
+    return NULL;
+}
+
+// Open (create) the log for appending; ring_size bytes of shared staging space
+static inline int applog_open(struct applog *log, const char *path, int durability, unsigned interval_ms,
+                              size_t ring_size) {
+    memset(log, 0, sizeof(*log));
+    log->durability = durability;
+    log->interval_ms = interval_ms ? interval_ms : 100;
+    log->ring_size = ring_size;
+    log->owner = getpid();
+    log->fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (log->fd == -1)
+        return -1;
+    log->shm = mmap(NULL, sizeof(struct applog_shm) + ring_size, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (log->shm == MAP_FAILED) {
+        int err = errno;
+        close(log->fd);
+        errno = err;
+        return -1;
+    }
+    struct stat st;
+    if (fstat(log->fd, &st) == -1) {
+        int err = errno;
+        munmap(log->shm, sizeof(struct applog_shm) + ring_size);
+        close(log->fd);
+        errno = err;
+        return -1;
+    }
+    log->shm->file_size = st.st_size;
+    pthread_mutexattr_t ma;
+    pthread_mutexattr_init(&ma);
+    pthread_mutexattr_setpshared(&ma, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&ma, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&log->shm->lock, &ma);
+    pthread_mutex_init(&log->shm->flush_lock, &ma);
+    pthread_mutexattr_destroy(&ma);
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setpshared(&ca, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_cond_init(&log->shm->cond, &ca);
+    pthread_condattr_destroy(&ca);
+
+    if (durability == APPLOG_PERIODIC && pthread_create(&log->syncer, NULL, applog_syncer, log) != 0) {
+        munmap(log->shm, sizeof(struct applog_shm) + ring_size);
+        close(log->fd);
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+// Each process closes its own copy; the opener also stops the syncer and syncs once more
+static inline int applog_close(struct applog *log) {
+    int ret = 0;
+    if (getpid() == log->owner && log->durability == APPLOG_PERIODIC) {
+        __atomic_store_n(&log->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(log->syncer, NULL);
+        ret = fdatasync(log->fd);
+    }
+    munmap(log->shm, sizeof(struct applog_shm) + log->ring_size);
+    if (close(log->fd) == -1)
+        ret = -1;
+    return ret;
+}
+
+#endif
@@ -0,0 +1,67 @@
+#!/bin/sh
+# Compare readwriteshell -w against coreutils wc on an ASCII and a UTF-8 corpus.
+# Usage: sh bench_wc.sh [size_in_MiB]      (default 1024)
+#
+# Words are compared with LC_ALL=C wc (the semantics readwriteshell uses),
+# UTF-8 characters with wc -m in a UTF-8 locale. Run it twice if you want to
+# measure with the corpora already in the page cache.
+
+set -e
+SIZE_MB=${1:-1024}
+DIR=${TMPDIR:-/tmp}/bench_wc.$$
+mkdir -p "$DIR"
+trap 'rm -rf "$DIR"' EXIT
+
+cd "$(dirname "$0")"
+gcc -O2 readwriteshell.c -o "$DIR/readwriteshell" -lpthread
+
+# Corpora: repeat a seed block until the file is SIZE_MB big
+make_corpus() { # $1 = seed text, $2 = output file
+    printf '%s' "$1" > "$DIR/seed"
+    while [ "$(stat -c %s "$DIR/seed")" -lt 1048576 ]; do
+        cat "$DIR/seed" "$DIR/seed" > "$DIR/seed2" && mv "$DIR/seed2" "$DIR/seed"
+    done
+    : > "$2"
+    i=0
+    while [ $i -lt "$SIZE_MB" ]; do
+        cat "$DIR/seed" >> "$2"
+        i=$((i + 1))
+    done
+}
+make_corpus "The quick brown fox jumps over the lazy dog 1234567890.
+	Tabs, two  spaces and punctuation: (a) [b] {c}!
+" "$DIR/ascii.txt"
+make_corpus "Größe naïve café — Ελληνικά кириллица 日本語のテキスト 한국어
+emoji 🙂 mixed with ASCII words and   spaces
+" "$DIR/utf8.txt"
+
+now() { date +%s.%N; }
+run() { # $1 = label, rest = command; prints seconds
+    label=$1
+    shift
+    t0=$(now)
+    "$@" > "$DIR/out"
+    t1=$(now)
+    awk -v a="$t0" -v b="$t1" -v l="$label" 'BEGIN { printf "  %-36s %7.3fs\n", l, b - a }'
+}
+
+THREADS=$(nproc)
+for corpus in ascii utf8; do
+    f="$DIR/$corpus.txt"
+    cat "$f" > /dev/null # warm the page cache
+    echo "$corpus corpus, $SIZE_MB MiB:"
+    run "LC_ALL=C wc -lwc" env LC_ALL=C wc -lwc "$f"
+    expect_lwc=$(awk '{ print $1, $2, $3 }' "$DIR/out")
+    run "LC_ALL=C.UTF-8 wc -m" env LC_ALL=C.UTF-8 wc -m "$f"
+    expect_m=$(awk '{ print $1 }' "$DIR/out")
+    run "readwriteshell -w (1 thread)" "$DIR/readwriteshell" -w "$f" /dev/stdout
+    run "cat | readwriteshell -w -" sh -c "cat '$f' | '$DIR/readwriteshell' -w - /dev/stdout"
+    run "readwriteshell -w -t $THREADS" "$DIR/readwriteshell" -w -t "$THREADS" "$f" /dev/stdout
+    got=$(awk -F': ' '{ v[NR] = $2 } END { print v[1], v[2], v[3] "|" v[4] }' "$DIR/out")
+    if [ "$got" = "$expect_lwc|$expect_m" ]; then
+        echo "  counts match wc ($got)"
+    else
+        echo "  MISMATCH: readwriteshell $got, wc $expect_lwc|$expect_m"
+        exit 1
+    fi
+done
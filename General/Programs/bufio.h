@@ -0,0 +1,247 @@
+/*
+ * Buffered reads and writes on a raw file descriptor.
+ *
+ * Programs like open.c and read_call_tillend_inchunks.c call read() for
+ * 10 or 99 bytes at a time: one system call per few bytes. A bufio reads
+ * the descriptor a whole buffer at a time (256 KiB by default) and hands
+ * out lines, exact byte counts or a peek at what comes next from memory.
+ * On the write side, small writes collect in the buffer. When a write
+ * does not fit, the buffered bytes and the new data go out together in
+ * one writev(), so nothing is copied twice and large writes are not split.
+ * A megabyte then costs 4 system calls each way instead of thousands.
+ *
+ * The buffer size is the cap argument of bio_init(). 0 means the
+ * BUFIO_SIZE environment variable if set, else BIO_DEFAULT_SIZE.
+ * Each struct bufio is either a reader or a writer, not both. Every
+ * read()/writev() it issues is counted in calls.
+ */
+#ifndef BUFIO_H
+#define BUFIO_H
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define BIO_DEFAULT_SIZE (1 << 18)
+
+struct bufio {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t pos, len;    // reader: unread bytes are [pos, len); writer: pending bytes are [0, len)
+    int eof;
+    uint64_t calls;     // system calls issued
+};
+
+static inline int bio_init(struct bufio *b, int fd, size_t cap) {
+    if (cap == 0) {
+        const char *env = getenv("BUFIO_SIZE");
+        cap = env != NULL && atol(env) > 0 ? (size_t)atol(env) : BIO_DEFAULT_SIZE;
+    }
+    b->fd = fd;
+    b->cap = cap;
+    b->pos = b->len = 0;
+    b->eof = 0;
+    b->calls = 0;
+    b->buf = malloc(cap);
+    return b->buf == NULL ? -1 : 0;
+}
+
+static inline void bio_free(struct bufio *b) {
+    free(b->buf);
+    b->buf = NULL;
+}
+
+// Reader: move unread bytes to the front and read() more. Returns bytes added, 0 at EOF, -1 on error.
+static inline ssize_t bio_fill(struct bufio *b) {
+    if (b->pos > 0) {
+        memmove(b->buf, b->buf + b->pos, b->len - b->pos);
+        b->len -= b->pos;
+        b->pos = 0;
+    }
+    if (b->eof || b->len == b->cap)
+        return 0;
+    ssize_t n;
+    do {
+        n = read(b->fd, b->buf + b->len, b->cap - b->len);
+        b->calls++;
+    } while (n < 0 && errno == EINTR);
+    if (n == 0)
+        b->eof = 1;
+    if (n > 0)
+        b->len += n;
+    return n;
+}
+
+// Up to n bytes: whatever is buffered, else at most one read(). 0 at EOF.
+static inline ssize_t bio_read(struct bufio *b, void *dst, size_t n) {
+    if (b->pos == b->len) {
+        if (b->eof)
+            return 0;
+        if (n >= b->cap) {
+            // Big request, empty buffer: read straight into the caller's memory
+            ssize_t r;
+            do {
+                r = read(b->fd, dst, n);
+                b->calls++;
+            } while (r < 0 && errno == EINTR);
+            if (r == 0)
+                b->eof = 1;
+            return r;
+        }
+        b->pos = b->len = 0;
+        ssize_t r = bio_fill(b);
+        if (r <= 0)
+            return r;
+    }
+    size_t k = b->len - b->pos < n ? b->len - b->pos : n;
+    memcpy(dst, b->buf + b->pos, k);
+    b->pos += k;
+    return k;
+}
+
+// Exactly n bytes unless EOF comes first: returns the count read (short only at EOF), -1 on error
+static inline ssize_t bio_read_exact(struct bufio *b, void *dst, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = bio_read(b, (char *)dst + got, n - got);
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;
+        got += r;
+    }
+    return got;
+}
+
+// Look at the next n bytes (n <= cap) without consuming them. *p points into the buffer
+// until the next call; returns how many are there (fewer than n only at EOF), -1 on error.
+static inline ssize_t bio_peek(struct bufio *b, size_t n, const char **p) {
+    if (n > b->cap)
+        n = b->cap;
+    while (b->len - b->pos < n) {
+        ssize_t r = bio_fill(b);
+        if (r < 0)
+            return -1;
+        if (r == 0)
+            break;
+    }
+    *p = b->buf + b->pos;
+    return b->len - b->pos < n ? b->len - b->pos : n;
+}
+
+// Next line, '\n' included (the last one may lack it). The line stays in the buffer until
+// the next call; the buffer grows for lines longer than it. NULL at EOF or on error.
+static inline char *bio_getline(struct bufio *b, size_t *len) {
+    size_t scanned = 0;
+    for (;;) {
+        char *start = b->buf + b->pos;
+        char *nl = memchr(start + scanned, '\n', b->len - b->pos - scanned);
+        if (nl != NULL) {
+            *len = nl + 1 - start;
+            b->pos += *len;
+            return start;
+        }
+        scanned = b->len - b->pos;
+        if (b->pos == 0 && b->len == b->cap) {
+            char *bigger = realloc(b->buf, b->cap * 2);
+            if (bigger == NULL)
+                return NULL;
+            b->buf = bigger;
+            b->cap *= 2;
+        }
+        ssize_t r = bio_fill(b);
+        if (r < 0)
+            return NULL;
+        if (r == 0 && b->eof) {
+            if (b->len == b->pos)
+                return NULL;
+            *len = b->len - b->pos;
+            start = b->buf + b->pos;
+            b->pos = b->len;
+            return start;
+        }
+    }
+}
+
+// Writer: write all of iov[0..cnt), looping over partial writes
+static inline int bio_writev_all(struct bufio *b, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        if (iov[0].iov_len == 0) {
+            iov++;
+            cnt--;
+            continue;
+        }
+        ssize_t n = writev(b->fd, iov, cnt);
+        b->calls++;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        while (n > 0) {
+            size_t k = (size_t)n < iov[0].iov_len ? (size_t)n : iov[0].iov_len;
+            iov[0].iov_base = (char *)iov[0].iov_base + k;
+            iov[0].iov_len -= k;
+            n -= k;
+            if (iov[0].iov_len == 0) {
+                iov++;
+                cnt--;
+            }
+        }
+    }
+    return 0;
+}
+
+static inline int bio_flush(struct bufio *b) {
+    struct iovec iov = {b->buf, b->len};
+    b->len = 0;
+    return bio_writev_all(b, &iov, 1);
+}
+
+// Buffer n bytes; if they do not fit, send the buffer and them together in one writev()
+static inline int bio_write(struct bufio *b, const void *src, size_t n) {
+    if (b->len + n <= b->cap) {
+        memcpy(b->buf + b->len, src, n);
+        b->len += n;
+        return 0;
+    }
+    struct iovec iov[2] = {{b->buf, b->len}, {(void *)src, n}};
+    b->len = 0;
+    return bio_writev_all(b, iov, 2);
+}
+
+static inline int bio_puts(struct bufio *b, const char *s) {
+    return bio_write(b, s, strlen(s));
+}
+
+__attribute__((format(printf, 2, 3)))
+static inline int bio_printf(struct bufio *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(b->buf + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    if (n < 0)
+        return -1;
+    if ((size_t)n < b->cap - b->len) {
+        b->len += n;
+        return 0;
+    }
+    // Did not fit: format into a temporary and write that
+    char *tmp = malloc(n + 1);
+    if (tmp == NULL)
+        return -1;
+    va_start(ap, fmt);
+    vsnprintf(tmp, n + 1, fmt, ap);
+    va_end(ap);
+    int ret = bio_write(b, tmp, n);
+    free(tmp);
+    return ret;
+}
+
+#endif
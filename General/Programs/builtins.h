@@ -0,0 +1,571 @@
+/*
+ * In-process builtins: wc, cat, head, tail, tee and grep -F.
+ *
+ * These run inside the calling process (as a thread of the pipeline
+ * executor in pipecommand.c, or directly from inputoutputredirection.c)
+ * so common pipeline tools cost no fork/execve at all. Input is read
+ * either from a file descriptor or from an in-memory buffer such as a
+ * read-only mmap of a file; output is batched through a large buffer so
+ * each write() moves many lines at once. Scanning uses memchr/memrchr/
+ * memmem, which glibc implements with SIMD. wc counts words with
+ * simdscan.h's scan_wc(), so it agrees with readwriteshell -w.
+ *
+ * bi_lookup() hands a command to a builtin only when every argument is
+ * one that builtin implements; any other option or operand (grep -i,
+ * cat -n, wc -m, head -n -1, tail -n +2, a grep file operand...) leaves
+ * the command to the real tool through execvp.
+ */
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "simdscan.h"
+
+#define BI_BUF_SIZE (128 * 1024)
+
+// Input side of a builtin: a descriptor, or a memory buffer when fd == -1
+struct bi_in {
+    int fd;
+    const char *mem;
+    size_t mem_len;
+    int eof;
+    char *buf;          // read buffer for descriptor input
+    size_t cap;
+    size_t start, end;  // unconsumed bytes are buf[start..end)
+};
+
+// Output side of a builtin: writes are batched and flushed in large blocks
+struct bi_out {
+    int fd;
+    char *buf;
+    size_t len, cap;
+    int err;            // set when a write fails (e.g. EPIPE), builtins stop early
+};
+
+static inline void bi_in_fd(struct bi_in *in, int fd) {
+    memset(in, 0, sizeof(*in));
+    in->fd = fd;
+}
+
+static inline void bi_in_mem(struct bi_in *in, const char *mem, size_t len) {
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+    in->mem = mem;
+    in->mem_len = len;
+}
+
+static inline void bi_in_free(struct bi_in *in) {
+    free(in->buf);
+    in->buf = NULL;
+}
+
+static inline int bi_out_init(struct bi_out *out, int fd, size_t cap) {
+    out->fd = fd;
+    out->len = 0;
+    out->cap = cap;
+    out->err = 0;
+    out->buf = malloc(cap);
+    return out->buf ? 0 : -1;
+}
+
+static inline int bi_write_all(int fd, const char *p, size_t n) {
+    while (n > 0) {
+        ssize_t w = write(fd, p, n);
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += w;
+        n -= w;
+    }
+    return 0;
+}
+
+static inline int bi_flush(struct bi_out *out) {
+    if (out->len > 0 && !out->err && bi_write_all(out->fd, out->buf, out->len) < 0)
+        out->err = errno;
+    out->len = 0;
+    return out->err ? -1 : 0;
+}
+
+static inline int bi_write(struct bi_out *out, const char *p, size_t n) {
+    if (out->err)
+        return -1;
+    if (out->len + n > out->cap) {
+        if (bi_flush(out) < 0)
+            return -1;
+        if (n >= out->cap) { // too big to batch, write straight through
+            if (bi_write_all(out->fd, p, n) < 0)
+                out->err = errno;
+            return out->err ? -1 : 0;
+        }
+    }
+    memcpy(out->buf + out->len, p, n);
+    out->len += n;
+    return 0;
+}
+
+static inline void bi_out_free(struct bi_out *out) {
+    bi_flush(out);
+    free(out->buf);
+    out->buf = NULL;
+}
+
+// Fill buf[end..cap) from the descriptor; returns bytes read, 0 on EOF, -1 on error
+static inline ssize_t bi_fill(struct bi_in *in) {
+    if (in->buf == NULL) {
+        in->cap = BI_BUF_SIZE;
+        in->buf = malloc(in->cap);
+        if (in->buf == NULL)
+            return -1;
+    }
+    if (in->start == in->end)
+        in->start = in->end = 0;
+    if (in->end == in->cap) {
+        if (in->start > 0) { // slide the pending bytes to the front
+            memmove(in->buf, in->buf + in->start, in->end - in->start);
+            in->end -= in->start;
+            in->start = 0;
+        } else {             // a single line longer than the buffer
+            char *nb = realloc(in->buf, in->cap * 2);
+            if (nb == NULL)
+                return -1;
+            in->buf = nb;
+            in->cap *= 2;
+        }
+    }
+    ssize_t r;
+    do {
+        r = read(in->fd, in->buf + in->end, in->cap - in->end);
+    } while (r < 0 && errno == EINTR);
+    if (r == 0)
+        in->eof = 1;
+    if (r > 0)
+        in->end += r;
+    return r;
+}
+
+// Next chunk of input in whatever size is available; 0 on EOF, -1 on error
+static inline ssize_t bi_read(struct bi_in *in, const char **p) {
+    if (in->fd < 0) {
+        if (in->eof)
+            return 0;
+        in->eof = 1;
+        *p = in->mem;
+        return in->mem_len;
+    }
+    if (in->start == in->end) {
+        in->start = in->end = 0;
+        ssize_t r = bi_fill(in);
+        if (r <= 0)
+            return r;
+    }
+    *p = in->buf + in->start;
+    ssize_t n = in->end - in->start;
+    in->start = in->end;
+    return n;
+}
+
+// Next chunk of input that ends on a line boundary (or at EOF)
+static inline ssize_t bi_read_lines(struct bi_in *in, const char **p) {
+    if (in->fd < 0)
+        return bi_read(in, p);
+    size_t scanned = in->start;
+    for (;;) {
+        if (in->end > scanned) {
+            const char *nl = memrchr(in->buf + scanned, '\n', in->end - scanned);
+            if (nl != NULL) {
+                *p = in->buf + in->start;
+                ssize_t n = nl + 1 - *p;
+                in->start += n;
+                return n;
+            }
+        }
+        if (in->eof) {
+            *p = in->buf + in->start;
+            ssize_t n = in->end - in->start;
+            in->start = in->end;
+            return n;
+        }
+        size_t pending = in->end - in->start;
+        ssize_t r = bi_fill(in);
+        if (r < 0)
+            return -1;
+        scanned = in->start + pending; // only the new bytes can hold a newline
+    }
+}
+
+// A plain line count. "+N" and "-N" mean something else to the real head/tail, so they are
+// rejected here rather than read by strtol() as N.
+static inline long bi_count_arg(const char *s) {
+    char *end;
+    if (*s < '0' || *s > '9')
+        return -1;
+    long v = strtol(s, &end, 10);
+    return *end == '\0' ? v : -1;
+}
+
+// cat [file...]
+static inline int bi_cat(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    const char *p;
+    ssize_t n;
+    if (argc < 2) {
+        while ((n = bi_read(in, &p)) > 0)
+            if (bi_write(out, p, n) < 0)
+                return 1;
+        return n < 0;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        struct bi_in fin;
+        int fd = open(argv[i], O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "cat: %s: %s\n", argv[i], strerror(errno));
+            status = 1;
+            continue;
+        }
+        bi_in_fd(&fin, fd);
+        while ((n = bi_read(&fin, &p)) > 0)
+            if (bi_write(out, p, n) < 0)
+                break;
+        bi_in_free(&fin);
+        close(fd);
+        if (out->err)
+            return 1;
+    }
+    return status;
+}
+
+// wc [-l] [-w] [-c]
+static inline int bi_wc(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    int want_l = 0, want_w = 0, want_c = 0;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-') {
+            fprintf(stderr, "wc: builtin reads standard input only\n");
+            return 1;
+        }
+        for (const char *o = argv[i] + 1; *o; o++) {
+            if (*o == 'l') want_l = 1;
+            else if (*o == 'w') want_w = 1;
+            else if (*o == 'c') want_c = 1;
+            else {
+                fprintf(stderr, "wc: invalid option -- '%c'\n", *o);
+                return 1;
+            }
+        }
+    }
+    if (!want_l && !want_w && !want_c)
+        want_l = want_w = want_c = 1;
+
+    // Words as in coreutils wc: scalar unless the program picked a kernel with scan_init()
+    struct scan_wc w = SCAN_WC_INIT;
+    long long lines = 0, words = 0, bytes = 0;
+    const char *p;
+    ssize_t n;
+    while ((n = bi_read(in, &p)) > 0) {
+        bytes += n;
+        if (want_w) {
+            scan_wc((const unsigned char *)p, n, &w);
+        } else if (want_l) {
+            const char *s = p, *end = p + n;
+            while ((s = memchr(s, '\n', end - s)) != NULL) {
+                lines++;
+                s++;
+            }
+        }
+    }
+    if (want_w) {
+        lines = w.lines;
+        words = w.words;
+    }
+    if (n < 0) {
+        perror("wc: read");
+        return 1;
+    }
+
+    // Same layout as coreutils wc on standard input
+    char line[96];
+    int len = 0, fields = want_l + want_w + want_c;
+    const char *fmt = fields == 1 ? "%lld" : "%7lld";
+    if (want_l)
+        len += snprintf(line + len, sizeof(line) - len, fmt, lines);
+    if (want_w)
+        len += snprintf(line + len, sizeof(line) - len, len ? " %7lld" : fmt, words);
+    if (want_c)
+        len += snprintf(line + len, sizeof(line) - len, len ? " %7lld" : fmt, bytes);
+    line[len++] = '\n';
+    return bi_write(out, line, len) < 0;
+}
+
+// head [-n N | -N]
+static inline int bi_head(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    long want = 10;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0)
+        want = bi_count_arg(argv[2]);
+    else if (argc == 2 && argv[1][0] == '-')
+        want = bi_count_arg(argv[1] + 1);
+    else if (argc != 1)
+        want = -1;
+    if (want < 0) {
+        fprintf(stderr, "head: usage: head [-n N]\n");
+        return 1;
+    }
+
+    const char *p;
+    ssize_t n;
+    while (want > 0 && (n = bi_read(in, &p)) > 0) {
+        const char *s = p, *end = p + n;
+        while (want > 0 && (s = memchr(s, '\n', end - s)) != NULL) {
+            s++;
+            want--;
+        }
+        if (bi_write(out, p, (want == 0 ? s : end) - p) < 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Offset in buf where its last N lines begin
+static inline size_t bi_last_lines(const char *buf, size_t len, long want) {
+    if (want == 0)
+        return len;
+    const char *e = len ? buf + len - 1 : buf; // a trailing newline ends the last line
+    while (e > buf) {
+        const char *nl = memrchr(buf, '\n', e - buf);
+        if (nl == NULL)
+            break;
+        if (--want == 0)
+            return nl + 1 - buf;
+        e = nl;
+    }
+    return 0;
+}
+
+// tail [-n N | -N]: keeps a window that always holds the last N lines
+static inline int bi_tail(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    long want = 10;
+    if (argc == 3 && strcmp(argv[1], "-n") == 0)
+        want = bi_count_arg(argv[2]);
+    else if (argc == 2 && argv[1][0] == '-')
+        want = bi_count_arg(argv[1] + 1);
+    else if (argc != 1)
+        want = -1;
+    if (want < 0) {
+        fprintf(stderr, "tail: usage: tail [-n N]\n");
+        return 1;
+    }
+    if (in->fd < 0) { // the whole input is already in memory
+        size_t from = bi_last_lines(in->mem, in->mem_len, want);
+        return bi_write(out, in->mem + from, in->mem_len - from) < 0;
+    }
+
+    char *win = NULL;
+    size_t len = 0, cap = 0, trim_at = 4 * BI_BUF_SIZE;
+    const char *p;
+    ssize_t n;
+    while ((n = bi_read(in, &p)) > 0) {
+        if (len + n > cap) {
+            cap = (len + n) * 2;
+            char *nw = realloc(win, cap);
+            if (nw == NULL) {
+                free(win);
+                perror("tail");
+                return 1;
+            }
+            win = nw;
+        }
+        memcpy(win + len, p, n);
+        len += n;
+        if (len > trim_at) { // drop everything before the last N lines
+            size_t from = bi_last_lines(win, len, want);
+            memmove(win, win + from, len - from);
+            len -= from;
+            trim_at = len + 4 * BI_BUF_SIZE;
+        }
+    }
+    size_t from = bi_last_lines(win, len, want);
+    int status = bi_write(out, win + from, len - from) < 0 || n < 0;
+    free(win);
+    return status;
+}
+
+// tee [-a] file...
+static inline int bi_tee(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    int append = argc > 1 && strcmp(argv[1], "-a") == 0;
+    int first = 1 + append, nfiles = argc - first, status = 0;
+    struct bi_out *files = calloc(nfiles > 0 ? nfiles : 1, sizeof(*files));
+    if (files == NULL)
+        return 1;
+    for (int i = 0; i < nfiles; i++) {
+        int fd = open(argv[first + i], O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+        if (fd == -1) {
+            fprintf(stderr, "tee: %s: %s\n", argv[first + i], strerror(errno));
+            status = 1;
+        }
+        files[i].fd = fd;
+    }
+
+    const char *p;
+    ssize_t n;
+    while ((n = bi_read(in, &p)) > 0) {
+        for (int i = 0; i < nfiles; i++)
+            if (files[i].fd != -1 && bi_write_all(files[i].fd, p, n) < 0)
+                status = 1;
+        if (bi_write(out, p, n) < 0)
+            break;
+    }
+    for (int i = 0; i < nfiles; i++)
+        if (files[i].fd != -1)
+            close(files[i].fd);
+    free(files);
+    return status || n < 0;
+}
+
+// Emit one matched line, supplying the newline a final unterminated line lacks
+static inline int bi_emit_line(struct bi_out *out, const char *s, const char *e) {
+    if (bi_write(out, s, e - s) < 0)
+        return -1;
+    return (e > s && e[-1] == '\n') ? 0 : bi_write(out, "\n", 1);
+}
+
+// grep [-F] [-v] [-c] PATTERN: fixed-string search only
+static inline int bi_grep(int argc, char **argv, struct bi_in *in, struct bi_out *out) {
+    int invert = 0, count_only = 0, i = 1;
+    for (; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; i++) {
+        for (const char *o = argv[i] + 1; *o; o++) {
+            if (*o == 'v') invert = 1;
+            else if (*o == 'c') count_only = 1;
+            else if (*o != 'F') {
+                fprintf(stderr, "grep: invalid option -- '%c'\n", *o);
+                return 2;
+            }
+        }
+    }
+    if (i != argc - 1) {
+        fprintf(stderr, "grep: usage: grep [-F] [-v] [-c] PATTERN\n");
+        return 2;
+    }
+    const char *pat = argv[i];
+    size_t plen = strlen(pat);
+    long long matches = 0;
+
+    const char *p;
+    ssize_t n;
+    while ((n = bi_read_lines(in, &p)) > 0 && !out->err) {
+        const char *s = p, *end = p + n, *m;
+        if (!invert) {
+            // Jump from match to match, expanding each hit to its line
+            while (s < end && (m = memmem(s, end - s, pat, plen)) != NULL) {
+                const char *ls = memrchr(s, '\n', m - s);
+                const char *le = memchr(m, '\n', end - m);
+                ls = ls ? ls + 1 : s;
+                le = le ? le + 1 : end;
+                matches++;
+                if (!count_only && bi_emit_line(out, ls, le) < 0)
+                    break;
+                s = le;
+            }
+        } else {
+            while (s < end) {
+                const char *le = memchr(s, '\n', end - s);
+                le = le ? le + 1 : end;
+                if (memmem(s, le - s, pat, plen) == NULL) {
+                    matches++;
+                    if (!count_only && bi_emit_line(out, s, le) < 0)
+                        break;
+                }
+                s = le;
+            }
+        }
+    }
+    if (n < 0) {
+        perror("grep: read");
+        return 2;
+    }
+    if (count_only) {
+        char line[32];
+        int len = snprintf(line, sizeof(line), "%lld\n", matches);
+        bi_write(out, line, len);
+    }
+    return matches ? 0 : 1;
+}
+
+struct builtin {
+    const char *name;
+    int (*run)(int argc, char **argv, struct bi_in *in, struct bi_out *out);
+};
+
+static const struct builtin bi_table[] = {
+    {"cat", bi_cat}, {"wc", bi_wc}, {"head", bi_head},
+    {"tail", bi_tail}, {"tee", bi_tee}, {"grep", bi_grep},
+};
+
+// An option argument made only of letters from opts: "-l", "-lw", "-vc"
+static inline int bi_is_opts(const char *a, const char *opts) {
+    if (a[0] != '-' || a[1] == '\0')
+        return 0;
+    for (a++; *a; a++)
+        if (strchr(opts, *a) == NULL)
+            return 0;
+    return 1;
+}
+
+// Returns the builtin that can run this command, or NULL to fall back to execvp. A builtin is
+// only taken when it implements every argument given; it never sees one it would reject.
+static inline const struct builtin *bi_lookup(int argc, char **argv) {
+    const struct builtin *b = NULL;
+    for (size_t i = 0; i < sizeof(bi_table) / sizeof(bi_table[0]); i++)
+        if (strcmp(argv[0], bi_table[i].name) == 0)
+            b = &bi_table[i];
+    if (b == NULL)
+        return NULL;
+    int a = 1;
+    if (b->run == bi_cat || b->run == bi_tee) {
+        // cat file..., tee [-a] file...: no other options, and no "-" operand
+        if (b->run == bi_tee && a < argc && strcmp(argv[a], "-a") == 0)
+            a++;
+        for (; a < argc; a++)
+            if (argv[a][0] == '-')
+                return NULL;
+        return b;
+    }
+    if (b->run == bi_wc) {
+        // wc [-l] [-w] [-c] on standard input only
+        for (; a < argc; a++)
+            if (!bi_is_opts(argv[a], "lwc"))
+                return NULL;
+        return b;
+    }
+    if (b->run == bi_head || b->run == bi_tail) {
+        // nothing, "-n N" or "-N", on standard input only
+        if (argc == 1)
+            return b;
+        if (argc == 3 && strcmp(argv[1], "-n") == 0)
+            return bi_count_arg(argv[2]) >= 0 ? b : NULL;
+        return argc == 2 && argv[1][0] == '-' && bi_count_arg(argv[1] + 1) >= 0 ? b : NULL;
+    }
+    // grep [-F] [-v] [-c] PATTERN on standard input, and only fixed strings: with -F, or a
+    // pattern with no regex metacharacters
+    int fixed = 0;
+    for (; a < argc && argv[a][0] == '-' && argv[a][1] != '\0'; a++) {
+        if (!bi_is_opts(argv[a], "Fvc"))
+            return NULL;
+        fixed |= strchr(argv[a], 'F') != NULL;
+    }
+    if (a != argc - 1)
+        return NULL;
+    if (!fixed && strpbrk(argv[a], ".[]*^$\\+?(){}|") != NULL)
+        return NULL;
+    return b;
+}
+
+#endif
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Compare fsearch against grep: same output and same exit status for each case.
+# Usage: sh check_fsearch.sh
+#
+# The big corpus is over 8 MiB, so it is cut into several chunks and the cases
+# also cover what happens at chunk boundaries (patterns that match the empty
+# string used to find a phantom empty line at the end of every chunk).
+
+DIR=${TMPDIR:-/tmp}/check_fsearch.$$
+mkdir -p "$DIR"
+trap 'rm -rf "$DIR"' EXIT
+
+cd "$(dirname "$0")"
+gcc -O2 fsearch.c -o "$DIR/fsearch" -lpthread || exit 1
+
+printf 'a\nb\n' > "$DIR/two.txt"
+printf 'a\n\nb' > "$DIR/blank.txt"
+: > "$DIR/empty.txt"
+i=0
+while [ $i -lt 3000 ]; do
+    printf 'line %d time=%dms ERROR\n\nplain text\n' $i $((i % 97))
+    i=$((i + 1))
+done > "$DIR/seed"
+i=0
+while [ $i -lt 100 ]; do
+    cat "$DIR/seed"
+    i=$((i + 1))
+done > "$DIR/big.txt"
+
+failed=0
+check() { # $@ = arguments shared by fsearch and grep
+    "$DIR/fsearch" "$@" > "$DIR/out.fsearch" 2>/dev/null
+    a=$?
+    grep "$@" > "$DIR/out.grep" 2>/dev/null
+    b=$?
+    if [ $a -ne $b ] || ! cmp -s "$DIR/out.fsearch" "$DIR/out.grep"; then
+        echo "FAIL: $* (exit $a, grep $b)"
+        failed=1
+    fi
+}
+
+for f in two.txt blank.txt empty.txt big.txt; do
+    for pat in '^$' 'x*' '^' '$'; do
+        check -E "$pat" "$DIR/$f"
+        check -n -E "$pat" "$DIR/$f"
+        check -c -E "$pat" "$DIR/$f"
+    done
+    check -n ERROR "$DIR/$f"
+    check -c -E 'time=[0-9]+ms' "$DIR/$f"
+    check -n -E 'time=(1|2)ms' "$DIR/$f"
+done
+
+[ $failed -eq 0 ] && echo "all cases match grep"
+exit $failed
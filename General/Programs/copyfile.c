@@ -0,0 +1,362 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+
+#define CFR_CHUNK (1 << 30)   // bytes per copy_file_range()/sendfile() call
+#define MAP_WINDOW (64 << 20) // bytes mapped at a time by the mmap copy
+#define PIPE_SIZE (1 << 20)   // pipe size asked for with F_SETPIPE_SZ for splice()
+#define RW_SIZE (1 << 20)     // buffer of the read()/write() copy
+
+// Copy [*off, end) of in to the same offsets of out. On failure *off is where it stopped.
+typedef int (*copy_fn)(int in, int out, off_t *off, off_t end);
+
+struct mechanism {
+    const char *name;
+    copy_fn copy;
+    uint64_t bytes;          // data copied this way
+};
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+// errno values that mean "not here", as opposed to a real I/O error
+static int unsupported(int err) {
+    return err == ENOSYS || err == EXDEV || err == EINVAL || err == EOPNOTSUPP || err == EBADF ||
+           err == ENOTTY || err == ENODEV;
+}
+
+// In the kernel, no user buffer; may also reflink or copy server-side on NFS/SMB
+static int copy_cfr(int in, int out, off_t *off, off_t end) {
+    while (*off < end) {
+        off_t src = *off, dst = *off;
+        size_t len = end - *off < CFR_CHUNK ? end - *off : CFR_CHUNK;
+        ssize_t n = copy_file_range(in, &src, out, &dst, len, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break; // the source shrank under us
+        *off += n;
+    }
+    return 0;
+}
+
+// In the kernel through the page cache; sendfile() writes at out's file position
+static int copy_sendfile(int in, int out, off_t *off, off_t end) {
+    while (*off < end) {
+        if (lseek(out, *off, SEEK_SET) == -1)
+            return -1;
+        off_t src = *off;
+        size_t len = end - *off < CFR_CHUNK ? end - *off : CFR_CHUNK;
+        ssize_t n = sendfile(out, in, &src, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        *off += n;
+    }
+    return 0;
+}
+
+static int splice_pipe[2] = {-1, -1};
+
+// File -> pipe -> file: pages move between the two without a copy to user space
+static int copy_splice(int in, int out, off_t *off, off_t end) {
+    if (splice_pipe[0] == -1) {
+        if (pipe(splice_pipe) == -1)
+            return -1;
+        fcntl(splice_pipe[1], F_SETPIPE_SZ, PIPE_SIZE); // fails harmlessly above pipe-max-size
+    }
+    while (*off < end) {
+        off_t src = *off;
+        size_t len = end - *off < PIPE_SIZE ? end - *off : PIPE_SIZE;
+        ssize_t n = splice(in, &src, splice_pipe[1], NULL, len, SPLICE_F_MOVE);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+        off_t dst = *off;
+        while (n > 0) {
+            ssize_t w = splice(splice_pipe[0], NULL, out, &dst, n, SPLICE_F_MOVE);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w <= 0) {
+                // Empty the pipe by hand so the next mechanism starts at a clean offset
+                int err = w < 0 ? errno : EIO;
+                char buf[4096];
+                while (n > 0) {
+                    ssize_t r = read(splice_pipe[0], buf, n < (ssize_t)sizeof(buf) ? n : (ssize_t)sizeof(buf));
+                    if (r <= 0 || pwrite(out, buf, r, dst) != r)
+                        return -1;
+                    dst += r;
+                    n -= r;
+                }
+                *off = dst;
+                errno = err;
+                return -1;
+            }
+            n -= w;
+        }
+        *off = dst;
+    }
+    return 0;
+}
+
+// Map the source a window at a time and pwrite() the mapping to the destination
+static int copy_mmap(int in, int out, off_t *off, off_t end) {
+    long page = sysconf(_SC_PAGESIZE);
+    while (*off < end) {
+        off_t base = *off & ~(off_t)(page - 1);
+        size_t skip = *off - base;
+        size_t len = end - base < MAP_WINDOW ? end - base : MAP_WINDOW;
+        char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, in, base);
+        if (map == MAP_FAILED)
+            return -1;
+        madvise(map, len, MADV_SEQUENTIAL);
+        for (size_t done = skip; done < len;) {
+            ssize_t n = pwrite(out, map + done, len - done, base + done);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                int err = errno;
+                munmap(map, len);
+                errno = err;
+                return -1;
+            }
+            done += n;
+            *off = base + done;
+        }
+        munmap(map, len);
+    }
+    return 0;
+}
+
+// The last resort: pread()/pwrite() through a 1 MiB buffer
+static int copy_rw(int in, int out, off_t *off, off_t end) {
+    static char *buf;
+    if (buf == NULL && (buf = malloc(RW_SIZE)) == NULL)
+        return -1;
+    while (*off < end) {
+        size_t len = end - *off < RW_SIZE ? end - *off : RW_SIZE;
+        ssize_t n = pread(in, buf, len, *off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n;
+        for (ssize_t done = 0; done < n;) {
+            ssize_t w = pwrite(out, buf + done, n - done, *off + done);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0)
+                return -1;
+            done += w;
+        }
+        *off += n;
+    }
+    return 0;
+}
+
+// Tried in this order; a mechanism that is unsupported for this pair of files is dropped for good
+static struct mechanism chain[] = {
+    {"copy_file_range", copy_cfr, 0},
+    {"sendfile", copy_sendfile, 0},
+    {"splice", copy_splice, 0},
+    {"mmap", copy_mmap, 0},
+    {"read/write", copy_rw, 0},
+};
+#define NMECH ((int)(sizeof(chain) / sizeof(chain[0])))
+
+struct copy_stats {
+    uint64_t extents, data;
+    int mech;                // current position in chain
+};
+
+// One data extent, moving down the chain whenever a mechanism says it cannot do this copy
+static int copy_extent(int in, int out, off_t start, off_t end, struct copy_stats *st) {
+    off_t off = start;
+    for (;;) {
+        off_t before = off;
+        int r = chain[st->mech].copy(in, out, &off, end);
+        chain[st->mech].bytes += off - before;
+        if (r == 0)
+            break;
+        if (!unsupported(errno) || st->mech == NMECH - 1)
+            return -1;
+        fprintf(stderr, "%s: %s, trying %s\n", chain[st->mech].name, strerror(errno), chain[st->mech + 1].name);
+        st->mech++;
+    }
+    st->extents++;
+    st->data += off - start;
+    return 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-M mechanism] [-m] <source> <destination>\n", prog);
+    fprintf(stderr, "  -M  start the chain at: reflink (default), copy_file_range, sendfile, splice,\n");
+    fprintf(stderr, "      mmap or readwrite\n");
+    fprintf(stderr, "  -m  same as -M mmap\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct copy_stats st;
+    memset(&st, 0, sizeof(st));
+    int reflink = 1, opt;
+    while ((opt = getopt(argc, argv, "M:m")) != -1) {
+        const char *name = opt == 'm' ? "mmap" : optarg;
+        if (opt != 'm' && opt != 'M')
+            usage(argv[0]);
+        if (strcmp(name, "reflink") == 0) {
+            reflink = 1;
+            st.mech = 0;
+            continue;
+        }
+        if (strcmp(name, "readwrite") == 0)
+            name = "read/write";
+        for (st.mech = 0; st.mech < NMECH && strcmp(name, chain[st.mech].name) != 0; st.mech++)
+            ;
+        if (st.mech == NMECH)
+            usage(argv[0]);
+        reflink = 0;
+    }
+    if (argc - optind != 2)
+        usage(argv[0]);
+
+    int in = open(argv[optind], O_RDONLY);
+    if (in == -1)
+        fail("open source file");
+    struct stat sst;
+    if (fstat(in, &sst) == -1)
+        fail("stat source file");
+    if (!S_ISREG(sst.st_mode)) {
+        fprintf(stderr, "%s: not a regular file\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    // No O_TRUNC yet: if the destination is the source (or a hard link to it), truncating
+    // would destroy the data before a single byte was copied
+    int out = open(argv[optind + 1], O_WRONLY | O_CREAT, sst.st_mode & 0777);
+    struct stat dst;
+    if (out == -1)
+        fail("open destination file");
+    if (fstat(out, &dst) == -1)
+        fail("stat destination file");
+    if (dst.st_dev == sst.st_dev && dst.st_ino == sst.st_ino) {
+        fprintf(stderr, "%s and %s are the same file\n", argv[optind], argv[optind + 1]);
+        exit(EXIT_FAILURE);
+    }
+    if (ftruncate(out, 0) == -1)
+        fail("truncate destination file");
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    off_t size = sst.st_size;
+    const char *used = NULL;
+
+    // Same CoW filesystem (btrfs, XFS, bcachefs...): share the extents, copy nothing
+    if (reflink) {
+        if (ioctl(out, FICLONE, in) == 0) {
+            used = "reflink";
+            st.data = size;
+        } else if (!unsupported(errno)) {
+            fail("FICLONE");
+        } else {
+            fprintf(stderr, "reflink: %s, trying %s\n", strerror(errno), chain[st.mech].name);
+        }
+    }
+
+    if (used == NULL) {
+        // Full size up front: whatever is never written stays a hole, including a trailing one
+        if (ftruncate(out, size) == -1)
+            fail("truncate destination file");
+        off_t off = 0;
+        while (off < size) {
+            off_t data = lseek(in, off, SEEK_DATA), hole;
+            if (data == -1 && errno == ENXIO)
+                break; // only a hole is left
+            if (data == -1) {
+                // No SEEK_DATA on this filesystem: the whole file is one extent
+                if (errno != EINVAL)
+                    fail("lseek SEEK_DATA");
+                data = off;
+                hole = size;
+            } else {
+                hole = lseek(in, data, SEEK_HOLE);
+                if (hole == -1)
+                    fail("lseek SEEK_HOLE");
+            }
+            if (hole > size)
+                hole = size;
+            if (copy_extent(in, out, data, hole, &st) == -1)
+                fail("copy");
+            off = hole;
+        }
+    }
+    if (close(out) == -1)
+        fail("close destination file");
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    if (stat(argv[optind + 1], &dst) == -1)
+        fail("stat destination file");
+    if (used != NULL) {
+        printf("%" PRIu64 " bytes shared with reflink\n", (uint64_t)size);
+    } else {
+        printf("%" PRIu64 " bytes: %" PRIu64 " data in %" PRIu64 " extents, %" PRIu64 " in holes\n",
+               (uint64_t)size, st.data, st.extents, (uint64_t)size - st.data);
+        for (int i = 0; i < NMECH; i++)
+            if (chain[i].bytes > 0)
+                printf("  %" PRIu64 " bytes with %s\n", chain[i].bytes, chain[i].name);
+    }
+    printf("%.3f s, %.1f MiB/s of file, %.1f MiB/s of data\n", secs, secs > 0 ? size / secs / 1048576.0 : 0.0,
+           secs > 0 ? st.data / secs / 1048576.0 : 0.0);
+    printf("allocated: source %lld KiB, destination %lld KiB\n", (long long)sst.st_blocks / 2,
+           (long long)dst.st_blocks / 2);
+    close(in);
+    return 0;
+}
+
+/*Explanation:
+Build: gcc -O2 copyfile.c -o copyfile
+
+Usage: truncate -s 10G disk.img; echo data | dd of=disk.img bs=1 seek=5G conv=notrunc
+       ./copyfile disk.img copy.img
+       ./copyfile -M splice disk.img copy.img     (skip reflink, copy_file_range and sendfile)
+
+A read()/write() copy like readwriteshell.c's moves every byte into a user buffer and back out,
+and reads the holes of a sparse file as zeros and writes those zeros out, so a 10 GiB image holding
+a few MiB of data becomes 10 GiB on disk.
+
+copyfile tries the cheapest copy first and steps down whenever the kernel says "not here":
+  reflink          ioctl(FICLONE): on a copy-on-write filesystem the new file shares the old one's
+                   extents. Nothing is copied, so 100 GB takes milliseconds; blocks are duplicated
+                   later only when one side is modified.
+  copy_file_range  the kernel copies (or reflinks, or has the NFS/SMB server copy) the range
+  sendfile         the kernel copies through the page cache
+  splice           pages move file -> pipe -> file
+  mmap             the source is mapped and written from the mapping
+  read/write       pread()/pwrite() through a 1 MiB buffer
+Except for reflink, which takes the whole file, only data extents are copied: lseek() with
+SEEK_DATA ("the next offset holding data") and SEEK_HOLE ("the next hole") walks the extents
+without reading anything, and the destination is sized with ftruncate() so skipped ranges stay
+holes. The output shows which mechanisms carried how many bytes and the throughput.*/
@@ -0,0 +1,458 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_DEPS 32
+#define MAX_WORKERS 64
+
+enum { WAITING, READY, RUNNING, DONE, FAILED, SKIPPED };
+
+struct job {
+    char *name;
+    char *cmd;
+    char *dep_names[MAX_DEPS];
+    int deps[MAX_DEPS];
+    int ndeps;
+    int unfinished;          // dependencies that have not completed yet
+    int state;
+    int status;
+    pid_t pid;
+    int slot;
+    double ready, start, end; // seconds since the run started
+    double path;             // longest chain of job durations ending with this job
+    int path_prev;           // dependency on that chain, or -1
+    char *out;               // captured stdout/stderr
+    size_t out_len, out_cap;
+};
+
+// A worker slot runs one job at a time and reads that job's capture pipe
+struct slot {
+    int fd;  // read end of the running job's pipe, -1 once every writer closed it
+    int job; // -1 when idle
+};
+
+static struct job *jobs;
+static int njobs;
+static int sigchld_pipe[2];
+static struct timespec t0;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec - t0.tv_sec) + (ts.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+// Self-pipe trick: wake up poll() when a child exits
+static void sigchld_handler(int signum) {
+    int saved = errno;
+    (void)signum;
+    write(sigchld_pipe[1], "x", 1);
+    errno = saved;
+}
+
+static char *trim(char *s) {
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r'))
+        *--e = '\0';
+    return s;
+}
+
+// Each line is "name: dep1 dep2 : command"; blank lines and '#' comments are skipped
+static int load_jobs(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (fp == NULL) {
+        perror(path);
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    int lineno = 0, cap_jobs = 0;
+    while (getline(&line, &cap, fp) != -1) {
+        lineno++;
+        char *s = trim(line);
+        if (*s == '\0' || *s == '#')
+            continue;
+        char *c1 = strchr(s, ':');
+        char *c2 = c1 ? strchr(c1 + 1, ':') : NULL;
+        if (c2 == NULL) {
+            fprintf(stderr, "%s:%d: expected \"name: deps : command\"\n", path, lineno);
+            return -1;
+        }
+        *c1 = *c2 = '\0';
+        s = trim(s);
+        for (int i = 0; i < njobs; i++) {
+            if (strcmp(jobs[i].name, s) == 0) {
+                fprintf(stderr, "%s:%d: duplicate job name '%s'\n", path, lineno, s);
+                return -1;
+            }
+        }
+        if (njobs == cap_jobs) {
+            cap_jobs = cap_jobs ? cap_jobs * 2 : 64;
+            jobs = realloc(jobs, cap_jobs * sizeof(*jobs));
+            if (jobs == NULL) {
+                perror("realloc");
+                return -1;
+            }
+        }
+        struct job *j = &jobs[njobs++];
+        memset(j, 0, sizeof(*j));
+        j->name = strdup(s);
+        j->cmd = strdup(trim(c2 + 1));
+        j->slot = j->path_prev = -1;
+        char *save;
+        for (char *d = strtok_r(c1 + 1, " \t", &save); d; d = strtok_r(NULL, " \t", &save)) {
+            if (j->ndeps == MAX_DEPS) {
+                fprintf(stderr, "%s:%d: too many dependencies (max %d)\n", path, lineno, MAX_DEPS);
+                return -1;
+            }
+            j->dep_names[j->ndeps++] = strdup(d);
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    // Resolve dependency names to indices
+    for (int i = 0; i < njobs; i++) {
+        for (int k = 0; k < jobs[i].ndeps; k++) {
+            int found = -1;
+            for (int m = 0; m < njobs && found < 0; m++)
+                if (strcmp(jobs[m].name, jobs[i].dep_names[k]) == 0)
+                    found = m;
+            if (found < 0) {
+                fprintf(stderr, "%s: unknown dependency '%s'\n", jobs[i].name, jobs[i].dep_names[k]);
+                return -1;
+            }
+            jobs[i].deps[k] = found;
+        }
+        jobs[i].unfinished = jobs[i].ndeps;
+    }
+    return 0;
+}
+
+// Kahn's algorithm on a scratch copy of the counters: every job must be reachable
+static int check_acyclic(void) {
+    int *left = malloc(njobs * sizeof(int)), *queue = malloc(njobs * sizeof(int));
+    int head = 0, tail = 0;
+    for (int i = 0; i < njobs; i++)
+        if ((left[i] = jobs[i].ndeps) == 0)
+            queue[tail++] = i;
+    while (head < tail) {
+        int done = queue[head++];
+        for (int i = 0; i < njobs; i++)
+            for (int k = 0; k < jobs[i].ndeps; k++)
+                if (jobs[i].deps[k] == done && --left[i] == 0)
+                    queue[tail++] = i;
+    }
+    if (tail < njobs) {
+        fprintf(stderr, "dependency cycle among:");
+        for (int i = 0; i < njobs; i++)
+            if (left[i] > 0)
+                fprintf(stderr, " %s", jobs[i].name);
+        fprintf(stderr, "\n");
+    }
+    free(left);
+    free(queue);
+    return tail == njobs ? 0 : -1;
+}
+
+static void launch(int id, struct slot *sl, int slot_no) {
+    struct job *j = &jobs[id];
+    j->state = RUNNING;
+    j->slot = slot_no;
+    j->start = now();
+    sl->job = id;
+
+    // A fresh pipe per job: a background process the job leaves behind can keep writing
+    // into its own pipe, but never into the output of the next job on this slot
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+    sl->fd = pipefd[0];
+
+    j->pid = fork();
+    if (j->pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    } else if (j->pid == 0) {
+        // stdout and stderr both go into the job's capture pipe (dup2 clears O_CLOEXEC)
+        dup2(pipefd[1], STDOUT_FILENO);
+        dup2(pipefd[1], STDERR_FILENO);
+        signal(SIGCHLD, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", j->cmd, (char *)NULL);
+        perror("execl");
+        _exit(127);
+    }
+    close(pipefd[1]);
+}
+
+// Pull whatever the slot's pipe holds into the running job's output buffer
+static void drain(struct slot *sl) {
+    struct job *j = &jobs[sl->job];
+    for (;;) {
+        if (j->out_cap - j->out_len < 4096) {
+            j->out_cap = j->out_cap ? j->out_cap * 2 : 8192;
+            j->out = realloc(j->out, j->out_cap);
+            if (j->out == NULL) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        ssize_t r = read(sl->fd, j->out + j->out_len, j->out_cap - j->out_len);
+        if (r <= 0)
+            break; // EAGAIN: empty for now
+        j->out_len += r;
+    }
+}
+
+static void skip_dependents(int id) {
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i].state != WAITING)
+            continue;
+        for (int k = 0; k < jobs[i].ndeps; k++) {
+            if (jobs[i].deps[k] == id) {
+                jobs[i].state = SKIPPED;
+                skip_dependents(i);
+                break;
+            }
+        }
+    }
+}
+
+static void report(double wall, int workers) {
+    double busy = 0;
+    int last = -1;
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i].state != DONE && jobs[i].state != FAILED)
+            continue;
+        busy += jobs[i].end - jobs[i].start;
+        if (last < 0 || jobs[i].path > jobs[last].path)
+            last = i;
+    }
+    fprintf(stderr, "\n--- schedule report ---\n");
+    fprintf(stderr, "wall %.3fs, job time %.3fs, average parallelism %.2f of %d workers\n",
+            wall, busy, wall > 0 ? busy / wall : 0, workers);
+    if (last < 0)
+        return;
+    fprintf(stderr, "critical path %.3fs (%.0f%% of wall):\n", jobs[last].path,
+            wall > 0 ? 100 * jobs[last].path / wall : 0);
+
+    // Walk the chain back from its last job, then print it front to back
+    int chain[njobs], n = 0;
+    for (int i = last; i >= 0; i = jobs[i].path_prev)
+        chain[n++] = i;
+    while (n-- > 0) {
+        struct job *j = &jobs[chain[n]];
+        fprintf(stderr, "  %-20s start %8.3f  end %8.3f  ran %8.3fs  queued %8.3fs\n",
+                j->name, j->start, j->end, j->end - j->start, j->start - j->ready);
+    }
+    // Long queue times mean the run was short of workers; a critical path close
+    // to the wall time means it was bound by the dependencies instead
+    fprintf(stderr, "idle worker time %.3fs\n", wall * workers - busy);
+}
+
+int main(int argc, char *argv[]) {
+    int workers = 4, keep_going = 0, opt;
+    while ((opt = getopt(argc, argv, "j:k")) != -1) {
+        if (opt == 'j') {
+            workers = atoi(optarg);
+        } else if (opt == 'k') {
+            keep_going = 1;
+        } else {
+            fprintf(stderr, "Usage: %s [-j workers] [-k] <jobfile>\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || workers < 1 || workers > MAX_WORKERS) {
+        fprintf(stderr, "Usage: %s [-j workers(1-%d)] [-k] <jobfile>\n", argv[0], MAX_WORKERS);
+        exit(EXIT_FAILURE);
+    }
+    if (load_jobs(argv[optind]) == -1 || check_acyclic() == -1)
+        exit(EXIT_FAILURE);
+
+    struct slot slots[MAX_WORKERS];
+    for (int s = 0; s < workers; s++) {
+        slots[s].fd = -1;
+        slots[s].job = -1;
+    }
+    if (pipe(sigchld_pipe) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fcntl(sigchld_pipe[0], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[1], F_SETFL, O_NONBLOCK);
+    fcntl(sigchld_pipe[0], F_SETFD, FD_CLOEXEC);
+    fcntl(sigchld_pipe[1], F_SETFD, FD_CLOEXEC);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int *ready = malloc(njobs * sizeof(int)); // FIFO of runnable jobs, in file order
+    int rhead = 0, rtail = 0, running = 0, failed = 0, finished = 0;
+    for (int i = 0; i < njobs; i++) {
+        if (jobs[i].unfinished == 0) {
+            jobs[i].state = READY;
+            ready[rtail++] = i;
+        }
+    }
+
+    while (finished < njobs) {
+        // Fill idle slots from the ready queue
+        for (int s = 0; s < workers && rhead < rtail && (!failed || keep_going); s++) {
+            if (slots[s].job == -1) {
+                launch(ready[rhead++], &slots[s], s);
+                running++;
+            }
+        }
+        if (running == 0)
+            break; // nothing left that may run (failures without -k)
+
+        struct pollfd pfd[MAX_WORKERS + 1];
+        for (int s = 0; s < workers; s++) {
+            pfd[s].fd = slots[s].job >= 0 ? slots[s].fd : -1; // poll() skips negative fds
+            pfd[s].events = POLLIN;
+        }
+        pfd[workers].fd = sigchld_pipe[0];
+        pfd[workers].events = POLLIN;
+        if (poll(pfd, workers + 1, -1) == -1 && errno != EINTR) {
+            perror("poll");
+            exit(EXIT_FAILURE);
+        }
+        for (int s = 0; s < workers; s++) {
+            if (pfd[s].fd < 0)
+                continue;
+            if (pfd[s].revents & (POLLIN | POLLHUP | POLLERR))
+                drain(&slots[s]);
+            // No writer left (the job closed or redirected its output but still runs): the
+            // pipe would report POLLHUP forever, so stop polling it until the job is reaped
+            if (pfd[s].revents & (POLLHUP | POLLERR)) {
+                close(slots[s].fd);
+                slots[s].fd = -1;
+            }
+        }
+
+        char tmp[64];
+        while (read(sigchld_pipe[0], tmp, sizeof(tmp)) > 0)
+            ;
+        int wstatus;
+        pid_t pid;
+        while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+            int id = -1;
+            for (int s = 0; s < workers && id < 0; s++)
+                if (slots[s].job >= 0 && jobs[slots[s].job].pid == pid)
+                    id = slots[s].job;
+            if (id < 0)
+                continue;
+            struct job *j = &jobs[id];
+            struct slot *sl = &slots[j->slot];
+            if (sl->fd >= 0) {
+                drain(sl); // the child is gone, so everything it wrote is in the pipe
+                close(sl->fd); // anything still holding the write end now gets EPIPE
+                sl->fd = -1;
+            }
+            sl->job = -1;
+            running--;
+            finished++;
+            j->end = now();
+            j->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+            j->state = j->status == 0 ? DONE : FAILED;
+
+            // Longest duration-weighted chain that ends here
+            j->path = j->end - j->start;
+            for (int k = 0; k < j->ndeps; k++) {
+                struct job *d = &jobs[j->deps[k]];
+                if (j->path_prev < 0 || d->path > jobs[j->path_prev].path)
+                    j->path_prev = j->deps[k];
+            }
+            if (j->path_prev >= 0)
+                j->path += jobs[j->path_prev].path;
+
+            printf("=== %s (exit %d, %.3fs)\n", j->name, j->status, j->end - j->start);
+            fwrite(j->out, 1, j->out_len, stdout);
+            fflush(stdout);
+
+            if (j->state == FAILED) {
+                failed++;
+                skip_dependents(id);
+                continue;
+            }
+            for (int i = 0; i < njobs; i++) {
+                if (jobs[i].state != WAITING)
+                    continue;
+                for (int k = 0; k < jobs[i].ndeps; k++) {
+                    if (jobs[i].deps[k] == id && --jobs[i].unfinished == 0) {
+                        jobs[i].state = READY;
+                        jobs[i].ready = j->end;
+                        ready[rtail++] = i;
+                    }
+                }
+            }
+        }
+    }
+
+    report(now(), workers);
+    int not_run = 0;
+    for (int i = 0; i < njobs; i++)
+        not_run += jobs[i].state != DONE && jobs[i].state != FAILED;
+    if (failed || not_run)
+        fprintf(stderr, "%d job(s) failed, %d not run\n", failed, not_run);
+    return failed || not_run ? EXIT_FAILURE : 0;
+}
+
+/*Explanation:
+Build: gcc dagrun.c -o dagrun
+Usage: ./dagrun -j 8 jobs.txt
+
+Job File:
+
+Each line is "name: dependencies : command", for example
+
+    gen:          : ./configure > config.h
+    a:   gen      : gcc -c a.c
+    b:   gen      : gcc -c b.c
+    app: a b      : gcc a.o b.o -o app
+
+The command is run with /bin/sh -c, the same way executecommand.c runs a command with execvp().
+
+Scheduling:
+
+A job becomes READY when all of its dependencies finished with exit status 0. Ready jobs wait in
+a FIFO and are started whenever one of the -j worker slots is idle, so independent jobs run in
+parallel and the order always respects the dependencies (a topological order).
+check_acyclic() runs Kahn's algorithm first and refuses files with a dependency cycle; job names
+must be unique.
+
+When a job fails its dependents are skipped; without -k no new jobs are started either.
+
+Output Capture:
+
+Every job gets its own pipe when it starts. Its stdout and stderr are dup2()'d onto the write
+end; the parent keeps only the read end, polls it and collects the output into a per-job buffer,
+printed in one piece when the job ends so parallel jobs never interleave. The read end is closed
+when the job exits, so a background process it left behind cannot leak output into the next
+job run on the same slot. A job can also close or redirect its output and keep running; its pipe
+then reports POLLHUP on every poll(), so the parent closes it right away instead of spinning. SIGCHLD is turned into a poll() wakeup with the self-pipe trick.
+
+Critical Path Report:
+
+For every job, path = its own run time + the largest path among its dependencies. The job with
+the largest path ends the critical path: no number of workers could finish sooner than that.
+If the critical path is close to the wall time, the run was limited by dependencies; if jobs
+spent a long time "queued" (ready but waiting for a slot), more workers would have helped.*/
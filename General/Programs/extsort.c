@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "bufio.h"
+
+#define MAX_THREADS 64
+#define FANIN 128              // runs merged at once; more runs take extra merge passes
+#define SMALL_SORT 64          // groups this small are sorted by comparison, not radix
+#define MIN_RUN_BUFFER (256 << 10)
+#define MAX_ARENA 0xffffffffULL // line offsets are 32-bit
+
+// One line of the arena. key holds 8 bytes of the line, big-endian, so comparing keys as
+// integers compares those bytes as memcmp() would (missing bytes count as 0).
+struct rec {
+    uint64_t key;
+    uint32_t off, len;  // line without its '\n'
+};
+
+struct run {
+    int fd;
+    struct bufio in;
+    const unsigned char *line;
+    size_t len;             // without the '\n'
+    uint64_t key;
+    int done;
+    uint64_t consumed;      // bytes taken so far
+    uint64_t prefetched;    // readahead has been requested up to here
+};
+
+struct phase {
+    const char *name;
+    uint64_t bytes;
+    double secs;
+};
+
+struct slice {
+    struct rec *recs, *tmp;
+    size_t n;
+    const unsigned char *text;
+    const char *tmpdir;
+    int fd;                 // the run it was spilled to
+    uint64_t bytes;
+    pthread_t thread;
+};
+
+static size_t run_buffer = 1 << 20;
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Bytes [from, from + 8) of a line as a big-endian integer, zero past the end
+static inline uint64_t load_key(const unsigned char *p, size_t len, size_t from) {
+    uint64_t k = 0;
+    if (from + 8 <= len) {
+        memcpy(&k, p + from, 8);
+        return __builtin_bswap64(k);
+    }
+    for (size_t i = 0; i < 8; i++)
+        k = k << 8 | (from + i < len ? p[from + i] : 0);
+    return k;
+}
+
+// LC_ALL=C order: memcmp(), then the shorter line first
+static int cmp_bytes(const unsigned char *a, size_t alen, const unsigned char *b, size_t blen) {
+    int c = memcmp(a, b, alen < blen ? alen : blen);
+    return c != 0 ? c : (alen > blen) - (alen < blen);
+}
+
+static int cmp_recs(const void *x, const void *y, void *text) {
+    const struct rec *a = x, *b = y;
+    const unsigned char *t = text;
+    return cmp_bytes(t + a->off, a->len, t + b->off, b->len);
+}
+
+// LSD radix sort on key, one byte per pass; passes where every key has the same byte are skipped
+static void radix_sort(struct rec *a, struct rec *tmp, size_t n) {
+    size_t count[8][256];
+    memset(count, 0, sizeof(count));
+    for (size_t i = 0; i < n; i++)
+        for (int b = 0; b < 8; b++)
+            count[b][(a[i].key >> (8 * b)) & 0xff]++;
+    struct rec *src = a, *dst = tmp;
+    for (int b = 0; b < 8; b++) {
+        if (count[b][(a[0].key >> (8 * b)) & 0xff] == n)
+            continue;
+        size_t pos[256], sum = 0;
+        for (int d = 0; d < 256; d++) {
+            pos[d] = sum;
+            sum += count[b][d];
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[pos[(src[i].key >> (8 * b)) & 0xff]++] = src[i];
+        struct rec *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a)
+        memcpy(a, src, n * sizeof(*a));
+}
+
+// Sort by the bytes from depth * 8 on (all lines here agree before that). Lines that tie on
+// those 8 bytes are sorted again on the next 8, until a group is small or no line is longer.
+static void sort_recs(struct rec *a, struct rec *tmp, size_t n, size_t depth, const unsigned char *text) {
+    if (n < SMALL_SORT) {
+        qsort_r(a, n, sizeof(*a), cmp_recs, (void *)text);
+        return;
+    }
+    if (depth > 0)
+        for (size_t i = 0; i < n; i++)
+            a[i].key = load_key(text + a[i].off, a[i].len, depth * 8);
+    radix_sort(a, tmp, n);
+    for (size_t i = 0, j; i < n; i = j) {
+        int longer = a[i].len > (depth + 1) * 8;
+        for (j = i + 1; j < n && a[j].key == a[i].key; j++)
+            longer |= a[j].len > (depth + 1) * 8;
+        if (j - i < 2)
+            continue;
+        if (longer)
+            sort_recs(a + i, tmp, j - i, depth + 1, text);
+        else
+            qsort_r(a + i, j - i, sizeof(*a), cmp_recs, (void *)text); // equal but for trailing NULs
+    }
+}
+
+static void *sort_thread(void *arg) {
+    struct slice *s = arg;
+    sort_recs(s->recs, s->tmp, s->n, 0, s->text);
+    return NULL;
+}
+
+// A new, already unlinked temporary file: it disappears when closed, even on a crash
+static int make_run_file(const char *tmpdir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/extsort.XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if (fd == -1)
+        fail("create run file");
+    unlink(path);
+    return fd;
+}
+
+// Write a sorted slice as one run, through a large buffer
+static void *spill_thread(void *arg) {
+    struct slice *s = arg;
+    struct bufio out;
+    s->fd = make_run_file(s->tmpdir);
+    if (bio_init(&out, s->fd, run_buffer) == -1)
+        fail("malloc");
+    s->bytes = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        if (bio_write(&out, s->text + s->recs[i].off, s->recs[i].len) == -1 || bio_write(&out, "\n", 1) == -1)
+            fail("write run");
+        s->bytes += s->recs[i].len + 1;
+    }
+    if (bio_flush(&out) == -1)
+        fail("write run");
+    bio_free(&out);
+    return NULL;
+}
+
+static void parallel(struct slice *sl, int n, void *(*fn)(void *)) {
+    for (int i = 0; i < n; i++)
+        if (pthread_create(&sl[i].thread, NULL, fn, &sl[i]) != 0)
+            fail("pthread_create");
+    for (int i = 0; i < n; i++)
+        pthread_join(sl[i].thread, NULL);
+}
+
+static void add_run(int **runs, size_t *nruns, size_t *cap, int fd) {
+    if (*nruns == *cap) {
+        *cap = *cap ? *cap * 2 : 64;
+        *runs = realloc(*runs, *cap * sizeof(**runs));
+        if (*runs == NULL)
+            fail("realloc");
+    }
+    (*runs)[(*nruns)++] = fd;
+}
+
+// Phase 1: fill the arena with whole lines, sort it in nthreads slices, spill each slice as a run
+static void make_runs(int in, size_t arena_size, int nthreads, const char *tmpdir, int **runs, size_t *nruns,
+                      struct phase *ph) {
+    unsigned char *arena = malloc(arena_size);
+    if (arena == NULL)
+        fail("malloc arena");
+    size_t have = 0, cap = 0, reccap = 0;
+    struct rec *recs = NULL, *tmp = NULL;
+    int eof = 0;
+    while (!eof || have > 0) {
+        double t0 = now();
+        while (!eof && have < arena_size) {
+            ssize_t n = read(in, arena + have, arena_size - have);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0)
+                fail("read input");
+            if (n == 0)
+                eof = 1;
+            have += n;
+        }
+        // Cut after the last complete line; the rest starts the next arena
+        size_t used = have;
+        if (!eof) {
+            const unsigned char *nl = memrchr(arena, '\n', have);
+            if (nl == NULL) {
+                // One line bigger than the arena: grow it
+                if (arena_size * 2 > MAX_ARENA) {
+                    errno = EFBIG;
+                    fail("line longer than the sort memory");
+                }
+                arena = realloc(arena, arena_size *= 2);
+                if (arena == NULL)
+                    fail("realloc arena");
+                continue;
+            }
+            used = nl - arena + 1;
+        }
+        if (used == 0)
+            break;
+        size_t n = 0;
+        for (size_t off = 0; off < used;) {
+            const unsigned char *nl = memchr(arena + off, '\n', used - off);
+            size_t len = nl != NULL ? (size_t)(nl - arena) - off : used - off;
+            if (n == reccap) {
+                reccap = reccap ? reccap * 2 : 1 << 16;
+                recs = realloc(recs, reccap * sizeof(*recs));
+                tmp = realloc(tmp, reccap * sizeof(*tmp));
+                if (recs == NULL || tmp == NULL)
+                    fail("realloc");
+            }
+            recs[n].key = load_key(arena + off, len, 0);
+            recs[n].off = off;
+            recs[n].len = len;
+            n++;
+            off += len + 1;
+        }
+        ph[0].secs += now() - t0;
+        ph[0].bytes += used;
+
+        // Sort, then spill, each slice on its own thread
+        struct slice sl[MAX_THREADS];
+        int nsl = n < (size_t)nthreads * SMALL_SORT ? 1 : nthreads;
+        for (int i = 0; i < nsl; i++) {
+            size_t lo = n * i / nsl, hi = n * (i + 1) / nsl;
+            sl[i].recs = recs + lo;
+            sl[i].tmp = tmp + lo;
+            sl[i].n = hi - lo;
+            sl[i].text = arena;
+            sl[i].tmpdir = tmpdir;
+        }
+        t0 = now();
+        parallel(sl, nsl, sort_thread);
+        ph[1].secs += now() - t0;
+        ph[1].bytes += used;
+        t0 = now();
+        parallel(sl, nsl, spill_thread);
+        ph[2].secs += now() - t0;
+        for (int i = 0; i < nsl; i++) {
+            ph[2].bytes += sl[i].bytes;
+            add_run(runs, nruns, &cap, sl[i].fd);
+        }
+
+        memmove(arena, arena + used, have - used);
+        have -= used;
+    }
+    free(arena);
+    free(recs);
+    free(tmp);
+}
+
+// Next line of a run, or done. Asks the kernel to read the following window ahead of time.
+static void run_next(struct run *r) {
+    size_t len;
+    char *line = bio_getline(&r->in, &len);
+    if (line == NULL) {
+        // NULL is also a failed read() or realloc(): losing the rest of the run would still
+        // leave a sorted, but silently truncated, output
+        if (!r->in.eof)
+            fail("read run");
+        r->done = 1;
+        return;
+    }
+    r->consumed += len;
+    if (r->consumed + run_buffer > r->prefetched) {
+        posix_fadvise(r->fd, r->prefetched, 2 * run_buffer, POSIX_FADV_WILLNEED);
+        r->prefetched += 2 * run_buffer;
+    }
+    r->line = (const unsigned char *)line;
+    r->len = len - (line[len - 1] == '\n');
+    r->key = load_key(r->line, r->len, 0);
+}
+
+// Does run a's line come before run b's? Finished runs lose to everything.
+static inline int run_less(const struct run *a, const struct run *b) {
+    if (a->done || b->done)
+        return !a->done;
+    if (a->key != b->key)
+        return a->key < b->key;
+    return cmp_bytes(a->line, a->len, b->line, b->len) < 0;
+}
+
+// Phase 2: k-way merge of runs[0..k) into out, with a loser tree: tree[1..k) holds the loser of
+// each match, tree[0] the overall winner, and the leaves are runs k..2k-1 in heap numbering.
+static uint64_t merge_runs(const int *fds, size_t k, int out_fd) {
+    struct run *runs = calloc(k, sizeof(*runs));
+    size_t *tree = malloc(2 * k * sizeof(*tree)), *win = malloc(2 * k * sizeof(*win));
+    if (runs == NULL || tree == NULL || win == NULL)
+        fail("malloc");
+    for (size_t i = 0; i < k; i++) {
+        runs[i].fd = fds[i];
+        if (lseek(fds[i], 0, SEEK_SET) == -1)
+            fail("lseek run");
+        posix_fadvise(fds[i], 0, 0, POSIX_FADV_SEQUENTIAL);
+        if (bio_init(&runs[i].in, fds[i], run_buffer) == -1)
+            fail("malloc");
+        run_next(&runs[i]);
+        win[k + i] = i;
+    }
+    for (size_t node = k - 1; node >= 1; node--) {
+        size_t a = win[2 * node], b = win[2 * node + 1];
+        int a_wins = run_less(&runs[a], &runs[b]) || (!run_less(&runs[b], &runs[a]) && a < b);
+        win[node] = a_wins ? a : b;
+        tree[node] = a_wins ? b : a;
+    }
+    tree[0] = k > 1 ? win[1] : 0;
+
+    struct bufio out;
+    if (bio_init(&out, out_fd, run_buffer * 4) == -1)
+        fail("malloc");
+    uint64_t bytes = 0;
+    while (!runs[tree[0]].done) {
+        size_t w = tree[0];
+        if (bio_write(&out, runs[w].line, runs[w].len) == -1 || bio_write(&out, "\n", 1) == -1)
+            fail("write output");
+        bytes += runs[w].len + 1;
+        run_next(&runs[w]);
+        // Replay the winner's path to the root against the stored losers
+        for (size_t node = (w + k) / 2; node >= 1; node /= 2) {
+            size_t l = tree[node];
+            if (run_less(&runs[l], &runs[w]) || (!run_less(&runs[w], &runs[l]) && l < w)) {
+                tree[node] = w;
+                w = l;
+            }
+        }
+        tree[0] = w;
+    }
+    if (bio_flush(&out) == -1)
+        fail("write output");
+    bio_free(&out);
+    for (size_t i = 0; i < k; i++)
+        bio_free(&runs[i].in);
+    free(runs);
+    free(tree);
+    free(win);
+    return bytes;
+}
+
+static void report(const struct phase *p) {
+    fprintf(stderr, "%-6s %10.1f MiB in %8.3f s  %9.1f MiB/s\n", p->name, p->bytes / 1048576.0, p->secs,
+            p->secs > 0 ? p->bytes / p->secs / 1048576.0 : 0.0);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m memory_MiB] [-t threads] [-T tmpdir] [-o output] [input]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    size_t mem = 512;
+    int nthreads = sysconf(_SC_NPROCESSORS_ONLN), opt;
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > MAX_THREADS)
+        nthreads = MAX_THREADS; // only an explicit -t beyond the limit is an error
+    const char *tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp", *output = NULL;
+    while ((opt = getopt(argc, argv, "m:o:t:T:")) != -1) {
+        switch (opt) {
+        case 'm':
+            mem = strtoul(optarg, NULL, 0);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 't':
+            nthreads = atoi(optarg);
+            break;
+        case 'T':
+            tmpdir = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1 || mem < 1 || nthreads < 1 || nthreads > MAX_THREADS)
+        usage(argv[0]);
+    int in = optind < argc ? open(argv[optind], O_RDONLY) : 0;
+    if (in == -1)
+        fail(argv[optind]);
+    posix_fadvise(in, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // About 40% of the memory holds text; line records (16 bytes each, twice for the radix
+    // scratch) take most of the rest for typical line lengths
+    size_t arena_size = mem * 1048576 / 5 * 2;
+    if (arena_size > MAX_ARENA)
+        arena_size = MAX_ARENA;
+    if (arena_size < 1 << 16)
+        arena_size = 1 << 16;
+
+    struct phase ph[4] = {{"read", 0, 0}, {"sort", 0, 0}, {"spill", 0, 0}, {"merge", 0, 0}};
+    int *runs = NULL;
+    size_t nruns = 0, cap = 0;
+    make_runs(in, arena_size, nthreads, tmpdir, &runs, &nruns, ph);
+    if (in != 0)
+        close(in);
+
+    // Each reader gets an equal share of the memory for its buffer
+    size_t fanin = nruns < FANIN ? nruns : FANIN;
+    run_buffer = fanin > 0 ? mem * 1048576 / 2 / (fanin + 4) : MIN_RUN_BUFFER;
+    if (run_buffer < MIN_RUN_BUFFER)
+        run_buffer = MIN_RUN_BUFFER;
+
+    // Too many runs for one merge: merge the oldest FANIN into a new run until few enough remain
+    double t0 = now();
+    size_t first = 0, passes = 0;
+    while (nruns - first > FANIN) {
+        int fd = make_run_file(tmpdir);
+        ph[3].bytes += merge_runs(runs + first, FANIN, fd);
+        for (size_t i = first; i < first + FANIN; i++)
+            close(runs[i]);
+        first += FANIN;
+        add_run(&runs, &nruns, &cap, fd);
+        passes++;
+    }
+    // Only now is the output truncated, so it may be the input file (like sort -o)
+    int out = output != NULL ? open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644) : 1;
+    if (out == -1)
+        fail(output);
+    if (nruns > first)
+        ph[3].bytes += merge_runs(runs + first, nruns - first, out);
+    ph[3].secs = now() - t0;
+    for (size_t i = first; i < nruns; i++)
+        close(runs[i]);
+    if (out != 1 && close(out) == -1)
+        fail("close output");
+
+    fprintf(stderr, "%zu runs, %zu-way merge%s, %d threads, %zu MiB memory\n", nruns - passes,
+            nruns - first, passes ? " after extra passes" : "", nthreads, mem);
+    for (int i = 0; i < 4; i++)
+        report(&ph[i]);
+    free(runs);
+    return 0;
+}
+
+/*Explanation:
+Build: gcc -O2 extsort.c -o extsort -lpthread
+
+Usage: ./extsort -m 1024 -o sorted.txt huge.txt     (1 GiB of memory, threads = CPUs)
+       ./extsort -t 4 -T /fast/tmp < huge.txt > sorted.txt
+
+The output is exactly what LC_ALL=C sort gives: lines compared byte by byte, a line that is a
+prefix of another first, and a final line without '\n' gets one.
+
+Phase 1 (read, sort, spill): read() fills an arena of about 40% of the memory with whole lines.
+Each line becomes a 16-byte record: its first 8 bytes as a big-endian integer, plus its offset
+and length. The records are split into one slice per thread. Each thread radix sorts its slice
+on that integer, 8 bits per pass, skipping passes where every key has the same byte. Lines
+that tie on 8 bytes are radix sorted again on the next 8 bytes; small groups use qsort(). The
+sorted slices are written out as runs through bufio.h in 1 MiB+ writes. Run files are unlinked
+as soon as they are created, so nothing is left behind.
+
+Phase 2 (merge): each run is rewound with lseek() and read through its own buffer, with
+posix_fadvise(WILLNEED) asking the kernel to read the next window ahead. A loser tree picks the
+smallest current line: every internal node remembers the loser of its match, so replacing the
+winner costs one comparison per level (log2 k) and most comparisons are single integer compares
+of the 8-byte keys. With more than 128 runs, the oldest 128 are first merged into a new run.
+
+Throughput of each phase is printed to stderr.*/
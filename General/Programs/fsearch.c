@@ -0,0 +1,456 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <regex.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bufio.h"
+#include "simdscan.h"
+
+#define CHUNK_SIZE (8 << 20) // bytes of a file per work item; items end on a line boundary
+#define MAX_THREADS 256
+#define MAX_LITERAL 256
+
+struct hit {
+    uint64_t line;          // newlines in the chunk before this line (with -n)
+    size_t start, len;      // the line, without its '\n'
+};
+
+struct chunk {
+    size_t start, end;
+    struct hit *hits;
+    size_t nhits, cap;
+    uint64_t newlines;      // in the whole chunk (with -n)
+    int done;
+};
+
+struct search {
+    // pattern
+    const unsigned char *literal;   // must appear in every matching line (NULL: no prefilter)
+    size_t litlen;
+    int use_regex;
+    regex_t re;
+    int line_numbers, count_only;
+    int nthreads;
+    // current file
+    const unsigned char *data;
+    size_t size;
+    struct chunk *chunks;
+    size_t nchunks, next;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void fail(const char *what) {
+    perror(what);
+    exit(2);
+}
+
+static void add_hit(struct chunk *c, uint64_t line, size_t start, size_t len) {
+    if (c->nhits == c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 64;
+        c->hits = realloc(c->hits, c->cap * sizeof(*c->hits));
+        if (c->hits == NULL)
+            fail("realloc");
+    }
+    c->hits[c->nhits].line = line;
+    c->hits[c->nhits].start = start;
+    c->hits[c->nhits].len = len;
+    c->nhits++;
+}
+
+// Newlines in data[from, to): scan_skip_lines() with a k it can never use up
+static uint64_t count_newlines(const unsigned char *data, size_t from, size_t to) {
+    uint64_t k = UINT64_MAX;
+    scan_skip_lines(data + from, to - from, &k);
+    return UINT64_MAX - k;
+}
+
+// Does the line data[ls, le) match the regex?
+static int regex_line(struct search *s, size_t ls, size_t le) {
+    regmatch_t m = {(regoff_t)ls, (regoff_t)le};
+    return regexec(&s->re, (const char *)s->data, 1, &m, REG_STARTEND) == 0;
+}
+
+// All matching lines of one chunk. Every position pos we search from is the start of a line.
+static void search_chunk(struct search *s, struct chunk *c) {
+    const unsigned char *data = s->data;
+    size_t pos = c->start, end = c->end, mark = c->start;
+    uint64_t line = 0;
+    while (pos < end) {
+        size_t at;
+        if (s->literal != NULL) {
+            // Prefilter: jump straight to the next occurrence of the literal
+            at = scan_find(data + pos, end - pos, s->literal, s->litlen);
+            if (at == SIZE_MAX)
+                break;
+            at += pos;
+        } else {
+            // No literal to look for: let the regex scan the rest of the chunk itself
+            regmatch_t m = {(regoff_t)pos, (regoff_t)end};
+            // A match at end after a '\n' is the empty position past the chunk's last line, not
+            // a line of its own (without the '\n' it is the end of the file's unterminated last line)
+            if (regexec(&s->re, (const char *)data, 1, &m, REG_STARTEND) != 0 ||
+                ((size_t)m.rm_so == end && data[end - 1] == '\n'))
+                break;
+            at = m.rm_so;
+        }
+        const unsigned char *nl = at > pos ? memrchr(data + pos, '\n', at - pos) : NULL;
+        size_t ls = nl != NULL ? (size_t)(nl - data) + 1 : pos;
+        nl = memchr(data + at, '\n', end - at);
+        size_t le = nl != NULL ? (size_t)(nl - data) : end;
+        if (s->literal == NULL || !s->use_regex || regex_line(s, ls, le)) {
+            if (s->line_numbers) {
+                line += count_newlines(data, mark, ls);
+                mark = ls;
+            }
+            add_hit(c, line, ls, le - ls);
+        }
+        pos = le + 1;
+    }
+    if (s->line_numbers)
+        c->newlines = line + count_newlines(data, mark, end);
+}
+
+static void *worker(void *arg) {
+    struct search *s = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&s->next, 1, __ATOMIC_RELAXED);
+        if (i >= s->nchunks)
+            return NULL;
+        search_chunk(s, &s->chunks[i]);
+        pthread_mutex_lock(&s->lock);
+        s->chunks[i].done = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+// Whole input in memory for things mmap() cannot map (stdin, pipes)
+static unsigned char *read_all(int fd, size_t *size) {
+    size_t cap = 1 << 20, len = 0;
+    unsigned char *buf = malloc(cap);
+    for (;;) {
+        if (buf == NULL)
+            fail("malloc");
+        ssize_t n = read(fd, buf + len, cap - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            int err = errno;
+            free(buf);
+            errno = err;
+            return NULL;
+        }
+        if (n == 0)
+            break;
+        len += n;
+        if (len == cap)
+            buf = realloc(buf, cap *= 2);
+    }
+    *size = len;
+    return buf;
+}
+
+// Search one file; matches go to out in file order. Returns matching lines, or -1.
+static int64_t search_file(struct search *s, const char *path, const char *prefix, struct bufio *out) {
+    int fd = strcmp(path, "-") == 0 ? 0 : open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        perror(path);
+        if (fd > 0)
+            close(fd);
+        return -1;
+    }
+    unsigned char *owned = NULL;
+    void *map = MAP_FAILED;
+    size_t map_len = 0;
+    // Search from the current offset: stdin may be a file someone already read part of
+    off_t pos = S_ISREG(st.st_mode) ? lseek(fd, 0, SEEK_CUR) : 0;
+    if (pos == -1 || pos > st.st_size)
+        pos = st.st_size;
+    // mmap() offsets must be page aligned: map from the start of the page holding pos
+    off_t map_off = pos & ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+    s->size = st.st_size - pos;
+    if (S_ISREG(st.st_mode) && s->size > 0) {
+        map_len = st.st_size - map_off;
+        map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, map_off);
+    }
+    if (map != MAP_FAILED) {
+        madvise(map, map_len, MADV_SEQUENTIAL);
+        s->data = (const unsigned char *)map + (pos - map_off);
+    } else if (S_ISREG(st.st_mode) && s->size == 0) {
+        s->data = (const unsigned char *)"";
+    } else if ((owned = read_all(fd, &s->size)) != NULL) {
+        s->data = owned;
+    } else {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    if (fd != 0)
+        close(fd);
+
+    // Work items of about CHUNK_SIZE bytes, each ending just after a '\n'
+    s->nchunks = 0;
+    s->chunks = malloc((s->size / CHUNK_SIZE + 1) * sizeof(*s->chunks));
+    if (s->chunks == NULL)
+        fail("malloc");
+    for (size_t off = 0; off < s->size;) {
+        size_t end = off + CHUNK_SIZE;
+        if (end >= s->size) {
+            end = s->size;
+        } else {
+            const unsigned char *nl = memchr(s->data + end, '\n', s->size - end);
+            end = nl != NULL ? (size_t)(nl - s->data) + 1 : s->size;
+        }
+        memset(&s->chunks[s->nchunks], 0, sizeof(struct chunk));
+        s->chunks[s->nchunks].start = off;
+        s->chunks[s->nchunks].end = end;
+        s->nchunks++;
+        off = end;
+    }
+    s->next = 0;
+
+    int nthreads = s->nthreads < (int)s->nchunks ? s->nthreads : (int)s->nchunks;
+    pthread_t threads[MAX_THREADS];
+    for (int i = 0; i < nthreads; i++)
+        if (pthread_create(&threads[i], NULL, worker, s) != 0)
+            fail("pthread_create");
+
+    // Print each chunk as soon as it and all before it are done, so output stays in file order
+    int64_t matches = 0;
+    uint64_t base = 0;
+    for (size_t i = 0; i < s->nchunks; i++) {
+        struct chunk *c = &s->chunks[i];
+        pthread_mutex_lock(&s->lock);
+        while (!c->done)
+            pthread_cond_wait(&s->cond, &s->lock);
+        pthread_mutex_unlock(&s->lock);
+        for (size_t h = 0; h < c->nhits && !s->count_only; h++) {
+            if (prefix != NULL)
+                bio_printf(out, "%s:", prefix);
+            if (s->line_numbers)
+                bio_printf(out, "%" PRIu64 ":", base + c->hits[h].line + 1);
+            bio_write(out, s->data + c->hits[h].start, c->hits[h].len);
+            bio_write(out, "\n", 1);
+        }
+        matches += c->nhits;
+        base += c->newlines;
+        free(c->hits);
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    if (s->count_only) {
+        if (prefix != NULL)
+            bio_printf(out, "%s:", prefix);
+        bio_printf(out, "%" PRId64 "\n", matches);
+    }
+
+    free(s->chunks);
+    free(owned);
+    if (map != MAP_FAILED)
+        munmap(map, map_len);
+    return matches;
+}
+
+// The longest run of plain characters that every match of an extended regex must contain.
+// Conservative: nothing inside () or [], nothing around a '|', and a character followed by
+// ?, * or {  may be absent. Returns its length (0: no usable literal).
+static size_t regex_literal(const char *re, char *lit) {
+    size_t best = 0, cur = 0;
+    char run[MAX_LITERAL];
+    int depth = 0;
+    if (strchr(re, '|') != NULL)
+        return 0;
+    for (const char *p = re; *p != '\0'; p++) {
+        char ch = 0;
+        int plain = 0;
+        if (*p == '[') {
+            // Skip the bracket expression, including a leading ] or ^] and [:class:]
+            const char *q = p + 1;
+            if (*q == '^')
+                q++;
+            if (*q == ']')
+                q++;
+            while (*q != '\0' && *q != ']') {
+                if (*q == '[' && (q[1] == ':' || q[1] == '.' || q[1] == '=')) {
+                    const char *close = strchr(q + 2, ']');
+                    q = close != NULL ? close : q + 1;
+                }
+                q++;
+            }
+            p = *q != '\0' ? q : q - 1;
+        } else if (*p == '{') {
+            // An interval {m,n}: the digits are not text
+            const char *close = strchr(p, '}');
+            p = close != NULL ? close : p;
+        } else if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            depth--;
+        } else if (*p == '\\' && p[1] != '\0') {
+            p++;
+            // \. \* etc. are the character itself; \w, \b and friends are not
+            plain = depth == 0 && strchr(".[]()*+?{}|^$\\/", *p) != NULL;
+            ch = *p;
+        } else if (strchr(".*+?{}^$", *p) == NULL) {
+            plain = depth == 0;
+            ch = *p;
+        }
+        // A quantifier after this character makes it optional (?, *, {0,...}); after a '+'
+        // it is still there, but what follows is no longer next to it
+        char next = plain ? p[1] : 0;
+        if (plain && next != '?' && next != '*' && next != '{' && cur < MAX_LITERAL - 1)
+            run[cur++] = ch;
+        else
+            plain = 0;
+        if (cur > best) {
+            best = cur;
+            memcpy(lit, run, cur);
+        }
+        if (!plain || next == '+')
+            cur = 0;
+    }
+    return best;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-F|-E] [-n] [-c] [-t threads] [-k scalar|sse2|avx2] <pattern> [file...]\n", prog);
+    fprintf(stderr, "  -F  fixed string (default when the pattern has no regex characters)\n");
+    fprintf(stderr, "  -E  POSIX extended regex\n");
+    fprintf(stderr, "  -n  line numbers    -c  count matching lines\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    struct search s;
+    memset(&s, 0, sizeof(s));
+    int fixed = -1, opt;
+    const char *kernel = NULL;
+    s.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+    while ((opt = getopt(argc, argv, "EFcnt:k:")) != -1) {
+        switch (opt) {
+        case 'E':
+            fixed = 0;
+            break;
+        case 'F':
+            fixed = 1;
+            break;
+        case 'c':
+            s.count_only = 1;
+            break;
+        case 'n':
+            s.line_numbers = 1;
+            break;
+        case 't':
+            s.nthreads = atoi(optarg);
+            break;
+        case 'k':
+            kernel = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        usage(argv[0]);
+    if (s.nthreads < 1 || s.nthreads > MAX_THREADS)
+        s.nthreads = s.nthreads < 1 ? 1 : MAX_THREADS;
+    if (scan_init(kernel) == -1) {
+        fprintf(stderr, "unknown or unsupported kernel: %s\n", kernel);
+        exit(2);
+    }
+    const char *pattern = argv[optind++];
+    if (strchr(pattern, '\n') != NULL) {
+        fprintf(stderr, "pattern must not contain a newline\n");
+        exit(2);
+    }
+    if (fixed == -1)
+        fixed = strpbrk(pattern, ".[]()*+?{}|^$\\") == NULL;
+
+    char lit[MAX_LITERAL];
+    if (fixed) {
+        s.literal = (const unsigned char *)pattern;
+        s.litlen = strlen(pattern);
+    } else {
+        int err = regcomp(&s.re, pattern, REG_EXTENDED | REG_NEWLINE);
+        if (err != 0) {
+            char msg[256];
+            regerror(err, &s.re, msg, sizeof(msg));
+            fprintf(stderr, "%s: %s\n", pattern, msg);
+            exit(2);
+        }
+        s.use_regex = 1;
+        s.litlen = regex_literal(pattern, lit);
+        s.literal = s.litlen > 0 ? (const unsigned char *)lit : NULL;
+    }
+    if (s.litlen == 0 && !s.use_regex) {
+        // The empty string matches every line
+        regcomp(&s.re, "", REG_EXTENDED | REG_NEWLINE);
+        s.use_regex = 1;
+        s.literal = NULL;
+    }
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.cond, NULL);
+
+    struct bufio out;
+    if (bio_init(&out, 1, 0) == -1)
+        fail("malloc");
+    int nfiles = argc - optind, status = 1;
+    if (nfiles == 0) {
+        argv[--optind] = "-";
+        nfiles = 1;
+    }
+    for (int i = optind; i < argc; i++) {
+        int64_t n = search_file(&s, argv[i], nfiles > 1 ? argv[i] : NULL, &out);
+        if (n < 0)
+            status = 2;
+        else if (n > 0 && status == 1)
+            status = 0;
+    }
+    if (bio_flush(&out) == -1)
+        fail("write output");
+    bio_free(&out);
+    return status;
+}
+
+/*Explanation:
+Build: gcc -O2 fsearch.c -o fsearch -lpthread
+
+Usage: ./fsearch ERROR big.log                  (fixed string)
+       ./fsearch -n -E 'time=[0-9]+ms' big.log  (extended regex, with line numbers)
+       ./fsearch -c -t 4 ERROR *.log            (count matching lines, 4 threads)
+
+Like grep: prints every line containing the pattern, with the file name when there are several
+files; exits 0 if something matched, 1 if nothing did, 2 on errors.
+
+open.c opens a file and read()s 10 bytes of it. fsearch opens each file the same way but maps
+it with mmap(), so the search runs straight over the page cache with no copies. The file is cut
+into 8 MiB pieces that end on a newline, and threads take pieces off a shared counter. Each
+piece records its matching lines as offsets into the mapping; the main thread prints piece 0,
+then waits for piece 1, and so on, so the output is in file order no matter which thread
+finished first. Line numbers are fixed up at that point from the newline count of each piece.
+
+A fixed string is found with scan_find() from simdscan.h: AVX2 compares 32 positions at once
+against the first byte of the pattern and, shifted by its length - 1, against the last byte;
+only positions where both match are checked with memcmp(). Text rarely has both bytes at the
+right distance, so most of the file is skipped 32 bytes at a time.
+
+A regex (regex.h) is slow per byte, so fsearch looks for the longest plain run of characters
+every match must contain ("time=" above), finds that with scan_find(), and runs regexec() only
+on the lines that contain it. Patterns with '|' or no such run are given to regexec() on the
+whole piece.
+
+sh check_fsearch.sh runs fsearch and grep on the same cases (including patterns that match the
+empty string, and a file of several pieces) and reports any difference in output or exit status.
+
+Input that is not a file (a pipe, a terminal) is read into memory first. A file given as stdin
+is searched from its current offset, like grep does, so "(head -c 10; ./fsearch x) < f" skips
+the bytes head consumed.*/
@@ -1,52 +1,313 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "builtins.h"
 
-int main(int argc, char *argv[]) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: %s <command> <input_file> <output_file>\n", argv[0]);
+#define MAX_ARGS 64
+#define OUT_BATCH (1 << 20) // builtin output is written in blocks of this size
+
+struct redirections {
+    const char *in_file;   // < file
+    const char *out_file;  // > file or >> file
+    int append;            // set for >>
+    const char *err_file;  // 2> file
+    int err_to_out;        // 2>&1
+    const char *here;      // <<< word
+};
+
+// Split one command string into words, honouring '...' and "..." quotes. quoted[i] is set
+// for a word that had quotes in it, so that '>' stays an argument instead of an operator.
+static int split_words(char *s, char **words, int *quoted) {
+    int n = 0;
+    while (*s) {
+        while (*s == ' ' || *s == '\t')
+            s++;
+        if (*s == '\0')
+            break;
+        if (n == MAX_ARGS) {
+            fprintf(stderr, "too many words (max %d)\n", MAX_ARGS);
+            exit(EXIT_FAILURE);
+        }
+        char *dst = s;
+        quoted[n] = 0;
+        words[n++] = dst;
+        while (*s && *s != ' ' && *s != '\t') {
+            if (*s == '\'' || *s == '"') {
+                quoted[n - 1] = 1;
+                char q = *s++;
+                while (*s && *s != q)
+                    *dst++ = *s++;
+                if (*s == q)
+                    s++;
+            } else {
+                *dst++ = *s++;
+            }
+        }
+        if (*s)
+            s++;
+        *dst = '\0';
+    }
+    return n;
+}
+
+// The operand of an operator is either glued to it (">out") or the next word ("> out")
+static const char *operand(char **words, int n, int *i, size_t oplen) {
+    if (words[*i][oplen] != '\0')
+        return words[*i] + oplen;
+    if (*i + 1 >= n) {
+        fprintf(stderr, "missing operand after '%s'\n", words[*i]);
         exit(EXIT_FAILURE);
     }
+    return words[++*i];
+}
 
-    char *command = argv[1];  // Command to execute (e.g., "wc")
-    char *input_file = argv[2];  // Input file (e.g., "f1")
-    char *output_file = argv[3];  // Output file (e.g., "f2")
+// Pull the redirection operators out of words[], leaving the command and its arguments
+static int parse_redirections(char **words, const int *quoted, int n, struct redirections *r) {
+    int argc = 0;
+    memset(r, 0, sizeof(*r));
+    for (int i = 0; i < n; i++) {
+        char *w = words[i];
+        if (quoted[i])
+            words[argc++] = w;
+        else if (strcmp(w, "2>&1") == 0)
+            r->err_to_out = 1;
+        else if (strncmp(w, "<<<", 3) == 0)
+            r->here = operand(words, n, &i, 3);
+        else if (strncmp(w, "2>", 2) == 0)
+            r->err_file = operand(words, n, &i, 2);
+        else if (strncmp(w, ">>", 2) == 0) {
+            r->out_file = operand(words, n, &i, 2);
+            r->append = 1;
+        } else if (w[0] == '>') {
+            r->out_file = operand(words, n, &i, 1);
+            r->append = 0;
+        } else if (w[0] == '<')
+            r->in_file = operand(words, n, &i, 1);
+        else
+            words[argc++] = w;
+    }
+    words[argc] = NULL;
+    return argc;
+}
 
-    // Open the input file for reading
-    int input_fd = open(input_file, O_RDONLY);
-    if (input_fd == -1) {
-        perror("open input file");
+static int open_output(const char *path, int append) {
+    int fd = open(path, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd == -1) {
+        perror("open output file");
         exit(EXIT_FAILURE);
     }
+    return fd;
+}
 
-    // Redirect stdin to the input file
-    if (dup2(input_fd, STDIN_FILENO) == -1) {
-        perror("dup2 stdin");
-        close(input_fd);
+// Here-string contents (word plus newline) as a descriptor, for external commands
+static int here_fd(const char *here) {
+    int fd = memfd_create("herestring", 0);
+    if (fd == -1) {
+        perror("memfd_create");
         exit(EXIT_FAILURE);
     }
-    close(input_fd);  // Close the original file descriptor
+    if (write(fd, here, strlen(here)) == -1 || write(fd, "\n", 1) == -1) {
+        perror("write here-string");
+        exit(EXIT_FAILURE);
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
 
-    // Open the output file for writing (create if it doesn't exist, truncate if it does)
-    int output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-    if (output_fd == -1) {
-        perror("open output file");
+// stderr redirections; 2>&1 is applied after stdout has been redirected
+static void redirect_stderr(const struct redirections *r) {
+    if (r->err_file != NULL) {
+        int fd = open_output(r->err_file, 0);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    if (r->err_to_out && dup2(STDOUT_FILENO, STDERR_FILENO) == -1) {
+        perror("dup2 stderr");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Run one of builtins.h in this process: no fork, no exec, no pipe in between
+static int run_builtin(const struct builtin *b, int argc, char **argv, const struct redirections *r) {
+    struct bi_in in;
+    struct bi_out out;
+    void *map = MAP_FAILED;
+    size_t map_len = 0;
+    char *here_buf = NULL;
+    int in_fd = -1;
+
+    if (r->here != NULL) {
+        size_t len = strlen(r->here);
+        here_buf = malloc(len + 1);
+        memcpy(here_buf, r->here, len);
+        here_buf[len] = '\n';
+        bi_in_mem(&in, here_buf, len + 1);
+    } else if (r->in_file != NULL) {
+        struct stat st;
+        in_fd = open(r->in_file, O_RDONLY);
+        if (in_fd == -1) {
+            perror("open input file");
+            exit(EXIT_FAILURE);
+        }
+        // Regular files are read straight from the page cache through a read-only mapping
+        if (fstat(in_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            map_len = st.st_size;
+            map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, in_fd, 0);
+        }
+        if (map != MAP_FAILED) {
+            madvise(map, map_len, MADV_SEQUENTIAL);
+            bi_in_mem(&in, map, map_len);
+        } else {
+            bi_in_fd(&in, in_fd);
+        }
+    } else {
+        bi_in_fd(&in, STDIN_FILENO);
+    }
+
+    int out_fd = STDOUT_FILENO;
+    if (r->out_file != NULL) {
+        out_fd = open_output(r->out_file, r->append);
+        if (dup2(out_fd, STDOUT_FILENO) == -1) {
+            perror("dup2 stdout");
+            exit(EXIT_FAILURE);
+        }
+    }
+    redirect_stderr(r);
+
+    // Output leaves in OUT_BATCH blocks, so an O_APPEND file sees few, large appends
+    if (bi_out_init(&out, out_fd, OUT_BATCH) == -1) {
+        perror("malloc");
+        exit(EXIT_FAILURE);
+    }
+    int status = b->run(argc, argv, &in, &out);
+    bi_out_free(&out);
+    bi_in_free(&in);
+
+    if (map != MAP_FAILED)
+        munmap(map, map_len);
+    if (in_fd != -1)
+        close(in_fd);
+    if (out_fd != STDOUT_FILENO)
+        close(out_fd);
+    free(here_buf);
+    return status;
+}
+
+int main(int argc, char *argv[]) {
+    char *words[MAX_ARGS + 1];
+    int quoted[MAX_ARGS], n = 0;
+
+    struct redirections r;
+    int cmd_argc;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s \"command [args] [< in | <<< word] [> out | >> out] [2> err | 2>&1]\"\n", argv[0]);
+        fprintf(stderr, "       %s -f <command> <input_file> <output_file>\n", argv[0]);
+        fprintf(stderr, "       %s <command> [args...]         (run as given, no redirections)\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    // Redirect stdout to the output file
-    if (dup2(output_fd, STDOUT_FILENO) == -1) {
-        perror("dup2 stdout");
-        close(output_fd);
+    if (argc == 5 && strcmp(argv[1], "-f") == 0) {
+        // Original form, asked for explicitly: command input_file output_file
+        memset(&r, 0, sizeof(r));
+        r.in_file = argv[3];
+        r.out_file = argv[4];
+        words[0] = argv[2];
+        words[1] = NULL;
+        cmd_argc = 1;
+    } else if (argc == 2) {
+        // The whole command line as one string: only here are operators recognised
+        n = split_words(argv[1], words, quoted);
+        cmd_argc = parse_redirections(words, quoted, n, &r);
+    } else {
+        // Separate arguments are passed through untouched, so a quoted '>' stays an argument
+        if (argc - 1 > MAX_ARGS) {
+            fprintf(stderr, "too many words (max %d)\n", MAX_ARGS);
+            exit(EXIT_FAILURE);
+        }
+        memset(&r, 0, sizeof(r));
+        for (int i = 1; i < argc; i++)
+            words[n++] = argv[i];
+        words[n] = NULL;
+        cmd_argc = n;
+    }
+    if (cmd_argc == 0) {
+        fprintf(stderr, "no command given\n");
+        exit(EXIT_FAILURE);
+    }
+
+    const struct builtin *b = bi_lookup(cmd_argc, words);
+    scan_init(NULL); // widest wc kernel for the builtin wc
+    if (b != NULL)
+        return run_builtin(b, cmd_argc, words, &r);
+
+    // External command: set up the descriptors, then exec
+    int input_fd = -1;
+    if (r.here != NULL)
+        input_fd = here_fd(r.here);
+    else if (r.in_file != NULL && (input_fd = open(r.in_file, O_RDONLY)) == -1) {
+        perror("open input file");
         exit(EXIT_FAILURE);
     }
-    close(output_fd);  // Close the original file descriptor
+    if (input_fd != -1) {
+        // Redirect stdin to the input file
+        if (dup2(input_fd, STDIN_FILENO) == -1) {
+            perror("dup2 stdin");
+            close(input_fd);
+            exit(EXIT_FAILURE);
+        }
+        close(input_fd);  // Close the original file descriptor
+    }
+
+    if (r.out_file != NULL) {
+        int output_fd = open_output(r.out_file, r.append);
+        // Redirect stdout to the output file
+        if (dup2(output_fd, STDOUT_FILENO) == -1) {
+            perror("dup2 stdout");
+            close(output_fd);
+            exit(EXIT_FAILURE);
+        }
+        close(output_fd);  // Close the original file descriptor
+    }
+    redirect_stderr(&r);
 
     // Execute the command
-    execlp(command, command, (char *)NULL);
+    execvp(words[0], words);
 
-    // If execlp returns, it means an error occurred
-    perror("execlp");
+    // If execvp returns, it means an error occurred
+    perror("execvp");
     exit(EXIT_FAILURE);
-}
\ No newline at end of file
+}
+
+/*Explanation:
+Build: gcc inputoutputredirection.c -o inputoutputredirection
+
+Usage: ./inputoutputredirection -f wc f1 f2                    (the original form: wc < f1 > f2)
+       ./inputoutputredirection "sort -r < f1 >> f2 2>&1"
+       ./inputoutputredirection "grep -F error <<< 'an error line'"
+       ./inputoutputredirection grep '>' f1                    (no command string: run as given)
+
+Operators are only recognised when the command is given as one string, and only unquoted:
+"grep '>' < f1" searches for '>'. Given as separate arguments, the command runs exactly as
+written, without any redirection.
+
+Operators: < file, > file, >> file, 2> file, 2>&1 and <<< word (here-string). They can be written
+apart ("> out") or glued to their operand (">out"). 2>&1 always refers to the final stdout.
+
+External Commands:
+
+Every redirection becomes open() + dup2() onto descriptor 0, 1 or 2 and the command is run with
+execvp(), so it inherits the redirected descriptors. A here-string is written into a memfd
+(an anonymous in-memory file) which then becomes stdin.
+
+Builtin Commands (cat, wc, head, tail, tee, grep -F from builtins.h):
+
+These run inside this process, nothing is forked or exec'd. A regular input file is mmap()ed
+read-only and the builtin scans the mapping directly, so the data is never copied through
+read() into a buffer or through a pipe. Output is gathered into a 1 MiB buffer and written in
+large blocks; with >> the file is opened with O_APPEND so each block is one atomic append.*/
@@ -0,0 +1,516 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include "uring_reader.h"
+
+#define MAX_THREADS 64
+#define MAX_LIST 16             // entries in each -e/-p/-b list
+#define FILL_SIZE (1 << 20)     // bytes per write() while laying out the file
+#define HIST_BITS 5             // latency buckets per power of two = 32: about 3% resolution
+#define HIST_SUB (1 << HIST_BITS)
+#define HIST_SIZE (64 * HIST_SUB)
+
+enum { ENG_BUFFERED, ENG_DIRECT, ENG_MMAP, ENG_URING, ENG_URING_DIRECT, ENG_COUNT };
+enum { PAT_READ, PAT_WRITE, PAT_RANDREAD, PAT_RANDWRITE, PAT_COUNT };
+
+static const char *engine_names[] = {"buffered", "direct", "mmap", "uring", "uring-direct"};
+static const char *pattern_names[] = {"read", "write", "randread", "randwrite"};
+
+struct config {
+    const char *path;
+    uint64_t size;          // bytes of the file used
+    double runtime;         // seconds per run
+    int threads;
+    unsigned depth;         // requests in flight per thread (uring engines)
+    int keep_cache;         // -C: don't drop the file from the page cache before a run
+};
+
+// Log-linear latency histogram: values below 2 * HIST_SUB ns are exact, above that each
+// power of two is split into HIST_SUB buckets. Fixed size, so runs of any length fit.
+struct hist {
+    uint64_t count[HIST_SIZE];
+    uint64_t n, max;
+};
+
+struct run {
+    int engine, pattern;
+    size_t bs;
+    int fd;
+    unsigned char *map;     // mmap engine
+    uint64_t size;          // whole blocks only
+    unsigned depth;
+    int threads;
+    uint64_t deadline;
+};
+
+struct worker {
+    const struct run *r;
+    int id, err;
+    uint64_t pos, begin, end;   // sequential patterns: this thread's slice of the file
+    uint64_t seed;              // random patterns
+    uint64_t ops;
+    struct hist hist;
+    pthread_t thread;
+};
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void hist_add(struct hist *h, uint64_t v) {
+    int i = v;
+    if (v >= 2 * HIST_SUB) {
+        int e = 63 - __builtin_clzll(v) - HIST_BITS;
+        i = e * HIST_SUB + (v >> e);
+    }
+    h->count[i]++;
+    h->n++;
+    if (v > h->max)
+        h->max = v;
+}
+
+static void hist_merge(struct hist *to, const struct hist *from) {
+    for (int i = 0; i < HIST_SIZE; i++)
+        to->count[i] += from->count[i];
+    to->n += from->n;
+    if (from->max > to->max)
+        to->max = from->max;
+}
+
+// Smallest bucket value with at least q of the samples at or below it (midpoint of the
+// bucket, but never above the largest sample)
+static double hist_quantile(const struct hist *h, double q) {
+    uint64_t want = (uint64_t)(q * h->n + 0.999999), seen = 0;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        seen += h->count[i];
+        if (seen >= want && h->count[i] > 0) {
+            if (i < 2 * HIST_SUB)
+                return i;
+            int e = i / HIST_SUB - 1;
+            double mid = ((uint64_t)(i - e * HIST_SUB) << e) + (1ULL << e) / 2.0;
+            return mid < h->max ? mid : h->max;
+        }
+    }
+    return h->max;
+}
+
+// "4k", "64K", "1m", "2G" or plain bytes
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t v = strtoull(s, &end, 0);
+    switch (*end) {
+    case 'k': case 'K': v <<= 10; end++; break;
+    case 'm': case 'M': v <<= 20; end++; break;
+    case 'g': case 'G': v <<= 30; end++; break;
+    }
+    return *end == '\0' ? v : 0;
+}
+
+// Split a comma list of names into indexes into names[]; returns the count, 0 on an unknown name
+static int parse_names(char *list, const char **names, int nnames, int *out) {
+    int n = 0;
+    char *save;
+    for (char *tok = strtok_r(list, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        int i = 0;
+        while (i < nnames && strcmp(tok, names[i]) != 0)
+            i++;
+        if (i == nnames || n == MAX_LIST)
+            return 0;
+        out[n++] = i;
+    }
+    return n;
+}
+
+static int is_write(int pattern) {
+    return pattern == PAT_WRITE || pattern == PAT_RANDWRITE;
+}
+
+static uint64_t next_offset(struct worker *w) {
+    const struct run *r = w->r;
+    if (r->pattern == PAT_RANDREAD || r->pattern == PAT_RANDWRITE) {
+        w->seed ^= w->seed << 13; // xorshift64
+        w->seed ^= w->seed >> 7;
+        w->seed ^= w->seed << 17;
+        return w->seed % (r->size / r->bs) * r->bs;
+    }
+    uint64_t off = w->pos;
+    w->pos += r->bs;
+    if (w->pos + r->bs > w->end)
+        w->pos = w->begin;
+    return off;
+}
+
+static void *alloc_buffer(size_t len) {
+    void *p;
+    if (posix_memalign(&p, UR_ALIGN, len) != 0)
+        fail("posix_memalign");
+    for (size_t i = 0; i < len; i++)
+        ((unsigned char *)p)[i] = i * 2654435761u >> 24; // not zeros, not compressible runs
+    return p;
+}
+
+// buffered, direct and mmap: one request at a time, timed around the call
+static void sync_worker(struct worker *w) {
+    const struct run *r = w->r;
+    unsigned char *buf = alloc_buffer(r->bs);
+    int writing = is_write(r->pattern);
+    for (;;) {
+        uint64_t off = next_offset(w), t0 = now_ns();
+        ssize_t n = r->bs;
+        if (r->engine == ENG_MMAP) {
+            if (writing)
+                memcpy(r->map + off, buf, r->bs);
+            else
+                memcpy(buf, r->map + off, r->bs);
+            __asm__ volatile("" : : "r"(buf) : "memory"); // the copy out must happen
+        } else if (writing) {
+            n = pwrite(r->fd, buf, r->bs, off);
+        } else {
+            n = pread(r->fd, buf, r->bs, off);
+        }
+        uint64_t t1 = now_ns();
+        if (n != (ssize_t)r->bs) {
+            w->err = n < 0 ? errno : EIO;
+            break;
+        }
+        hist_add(&w->hist, t1 - t0);
+        w->ops++;
+        if (t1 >= r->deadline)
+            break;
+    }
+    free(buf);
+}
+
+// Queue a read or write of the next block into/from buffer i (registered as index i if fixed)
+static void queue_request(struct worker *w, struct uring *u, unsigned i, void *buf, int fixed) {
+    const struct run *r = w->r;
+    int writing = is_write(r->pattern);
+    struct io_uring_sqe *sqe = uring_get_sqe(u);
+    sqe->opcode = fixed ? (writing ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED)
+                        : (writing ? IORING_OP_WRITE : IORING_OP_READ);
+    sqe->fd = r->fd;
+    sqe->off = next_offset(w);
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = r->bs;
+    sqe->buf_index = fixed ? i : 0;
+    sqe->user_data = i;
+}
+
+// uring engines: keep 'depth' requests in flight, each timed from queueing to completion
+static void uring_worker(struct worker *w) {
+    const struct run *r = w->r;
+    struct uring u;
+    if (uring_init(&u, r->depth) == -1) {
+        w->err = errno;
+        return;
+    }
+    unsigned char *bufs = alloc_buffer(r->depth * r->bs);
+    uint64_t *issued = malloc(r->depth * sizeof(uint64_t));
+    struct iovec *iov = malloc(r->depth * sizeof(struct iovec));
+    if (issued == NULL || iov == NULL)
+        fail("malloc");
+    for (unsigned i = 0; i < r->depth; i++) {
+        iov[i].iov_base = bufs + i * r->bs;
+        iov[i].iov_len = r->bs;
+    }
+    // Fixed buffers save pinning pages per request; RLIMIT_MEMLOCK may refuse them
+    int fixed = uring_register_buffers(&u, iov, r->depth) == 0;
+    unsigned inflight = 0;
+    for (unsigned i = 0; i < r->depth; i++, inflight++) {
+        queue_request(w, &u, i, iov[i].iov_base, fixed);
+        issued[i] = now_ns();
+    }
+    int stopping = 0;
+    while (inflight > 0) {
+        if (uring_submit(&u, 1) == -1) {
+            w->err = errno;
+            break; // closing the ring below cancels what is still in flight
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek_cqe(&u)) != NULL) {
+            unsigned i = cqe->user_data;
+            int res = cqe->res;
+            uring_cqe_seen(&u);
+            uint64_t t = now_ns();
+            inflight--;
+            if (res != (int)r->bs) {
+                if (w->err == 0)
+                    w->err = res < 0 ? -res : EIO;
+                stopping = 1;
+                continue;
+            }
+            hist_add(&w->hist, t - issued[i]);
+            w->ops++;
+            if (stopping || t >= r->deadline)
+                continue;
+            queue_request(w, &u, i, iov[i].iov_base, fixed);
+            issued[i] = now_ns();
+            inflight++;
+        }
+    }
+    uring_exit(&u);
+    free(bufs);
+    free(issued);
+    free(iov);
+}
+
+static void *worker_thread(void *arg) {
+    struct worker *w = arg;
+    if (w->r->engine == ENG_URING || w->r->engine == ENG_URING_DIRECT)
+        uring_worker(w);
+    else
+        sync_worker(w);
+    return NULL;
+}
+
+// Make a regular file at least cfg->size bytes of real (non-hole) data. A block device is
+// never written here: -s is capped at its size. Returns 1 for a block device.
+static int lay_out(struct config *cfg) {
+    int fd = open(cfg->path, O_RDONLY);
+    if (fd == -1 && errno == ENOENT)
+        fd = open(cfg->path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+        fail(cfg->path);
+    if (S_ISBLK(st.st_mode)) {
+        uint64_t bytes;
+        if (ioctl(fd, BLKGETSIZE64, &bytes) == -1)
+            fail("BLKGETSIZE64");
+        if (cfg->size > bytes)
+            cfg->size = bytes;
+        close(fd);
+        return 1;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s: not a regular file or block device\n", cfg->path);
+        exit(EXIT_FAILURE);
+    }
+    if ((uint64_t)st.st_size < cfg->size) {
+        close(fd);
+        fd = open(cfg->path, O_RDWR);
+        if (fd == -1)
+            fail(cfg->path);
+        unsigned char *buf = alloc_buffer(FILL_SIZE);
+        fprintf(stderr, "laying out %s: %" PRIu64 " MiB\n", cfg->path, cfg->size >> 20);
+        for (uint64_t off = st.st_size; off < cfg->size;) {
+            size_t len = cfg->size - off < FILL_SIZE ? cfg->size - off : FILL_SIZE;
+            ssize_t n = pwrite(fd, buf, len, off);
+            if (n <= 0)
+                fail("write");
+            off += n;
+        }
+        if (fdatasync(fd) == -1)
+            fail("fdatasync");
+        free(buf);
+    }
+    close(fd);
+    return 0;
+}
+
+static void run_one(const struct config *cfg, int engine, int pattern, size_t bs) {
+    struct run r = {engine, pattern, bs, -1, NULL, cfg->size / bs * bs, cfg->depth, cfg->threads, 0};
+    int direct = engine == ENG_DIRECT || engine == ENG_URING_DIRECT;
+    unsigned depth = engine == ENG_URING || engine == ENG_URING_DIRECT ? cfg->depth : 1;
+    printf("%-12s %-9s %7zu %5u %4d ", engine_names[engine], pattern_names[pattern], bs, depth, cfg->threads);
+    fflush(stdout);
+    if (r.size == 0) {
+        printf("skipped: block size larger than the file\n");
+        return;
+    }
+
+    // Start cold: write back what earlier runs dirtied, then drop the file's cached pages
+    r.fd = open(cfg->path, (is_write(pattern) ? O_RDWR : O_RDONLY) | (direct ? O_DIRECT : 0));
+    if (r.fd == -1) {
+        printf("unavailable: %s\n", strerror(errno));
+        return;
+    }
+    if (!cfg->keep_cache) {
+        fdatasync(r.fd);
+        posix_fadvise(r.fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (engine == ENG_MMAP) {
+        r.map = mmap(NULL, r.size, is_write(pattern) ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, r.fd, 0);
+        if (r.map == MAP_FAILED)
+            fail("mmap");
+    }
+
+    struct worker *w = calloc(cfg->threads, sizeof(*w));
+    if (w == NULL)
+        fail("calloc");
+    uint64_t slice = r.size / bs / cfg->threads * bs, t0 = now_ns();
+    r.deadline = t0 + (uint64_t)(cfg->runtime * 1e9);
+    for (int i = 0; i < cfg->threads; i++) {
+        w[i].r = &r;
+        w[i].id = i;
+        w[i].begin = slice ? i * slice : 0;
+        w[i].end = slice ? w[i].begin + slice : r.size;
+        w[i].pos = w[i].begin;
+        w[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1) ^ t0;
+        if (pthread_create(&w[i].thread, NULL, worker_thread, &w[i]) != 0)
+            fail("pthread_create");
+    }
+    static struct hist all; // 16 KiB: kept off the stack
+    memset(&all, 0, sizeof(all));
+    int err = 0;
+    for (int i = 0; i < cfg->threads; i++) {
+        pthread_join(w[i].thread, NULL);
+        hist_merge(&all, &w[i].hist);
+        if (err == 0)
+            err = w[i].err;
+    }
+    // Writes count as done once they are on the device, as with fio's end_fsync
+    if (is_write(pattern) && err == 0) {
+        if (engine == ENG_MMAP ? msync(r.map, r.size, MS_SYNC) : fdatasync(r.fd))
+            err = errno;
+    }
+    double secs = (now_ns() - t0) / 1e9;
+    if (r.map != NULL)
+        munmap(r.map, r.size);
+    close(r.fd);
+    free(w);
+
+    if (err != 0 && all.n == 0) {
+        printf("unavailable: %s\n", strerror(err));
+        return;
+    }
+    printf("%9.1f %9.0f %9.1f %9.1f %9.1f %9.1f%s%s\n", all.n * bs / secs / 1048576.0, all.n / secs,
+           hist_quantile(&all, 0.50) / 1e3, hist_quantile(&all, 0.99) / 1e3, hist_quantile(&all, 0.999) / 1e3,
+           all.max / 1e3, err ? "  error: " : "", err ? strerror(err) : "");
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-e engines] [-p patterns] [-b sizes] [-q depth] [-t threads] [-s size] "
+                    "[-r seconds] [-C] <file>\n", prog);
+    fprintf(stderr, "  -e  comma list of buffered,direct,mmap,uring,uring-direct (default: all)\n");
+    fprintf(stderr, "  -p  comma list of read,write,randread,randwrite (default: all)\n");
+    fprintf(stderr, "  -b  comma list of block sizes (default 4k,64k,1m)\n");
+    fprintf(stderr, "  -q  requests in flight per thread for the uring engines (default 32)\n");
+    fprintf(stderr, "  -s  bytes of the file to use, created if missing (default 256m)\n");
+    fprintf(stderr, "      a block device is only written when -p names a write pattern\n");
+    fprintf(stderr, "  -r  seconds per run (default 2)\n");
+    fprintf(stderr, "  -C  keep the file in the page cache between runs\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    struct config cfg = {NULL, 256 << 20, 2.0, 1, 32, 0};
+    int engines[MAX_LIST], patterns[MAX_LIST], nengines = ENG_COUNT, npatterns = PAT_COUNT, nsizes = 3, opt;
+    int patterns_given = 0;
+    size_t sizes[MAX_LIST] = {4 << 10, 64 << 10, 1 << 20};
+    for (int i = 0; i < ENG_COUNT; i++)
+        engines[i] = i;
+    for (int i = 0; i < PAT_COUNT; i++)
+        patterns[i] = i;
+    while ((opt = getopt(argc, argv, "e:p:b:q:t:s:r:C")) != -1) {
+        switch (opt) {
+        case 'e':
+            if ((nengines = parse_names(optarg, engine_names, ENG_COUNT, engines)) == 0)
+                usage(argv[0]);
+            break;
+        case 'p':
+            if ((npatterns = parse_names(optarg, pattern_names, PAT_COUNT, patterns)) == 0)
+                usage(argv[0]);
+            patterns_given = 1;
+            break;
+        case 'b': {
+            char *save;
+            nsizes = 0;
+            for (char *tok = strtok_r(optarg, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+                if (nsizes == MAX_LIST || (sizes[nsizes++] = parse_size(tok)) == 0)
+                    usage(argv[0]);
+            }
+            break;
+        }
+        case 'q':
+            cfg.depth = atoi(optarg);
+            break;
+        case 't':
+            cfg.threads = atoi(optarg);
+            break;
+        case 's':
+            cfg.size = parse_size(optarg);
+            break;
+        case 'r':
+            cfg.runtime = atof(optarg);
+            break;
+        case 'C':
+            cfg.keep_cache = 1;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc - 1 || nsizes == 0 || cfg.depth < 1 || cfg.depth > UR_MAX_DEPTH || cfg.threads < 1 ||
+        cfg.threads > MAX_THREADS || cfg.size == 0 || cfg.runtime <= 0)
+        usage(argv[0]);
+    cfg.path = argv[optind];
+
+    // A device holds someone's data: only write to it when -p asks for writes by name
+    if (lay_out(&cfg) && !patterns_given) {
+        npatterns = 0;
+        for (int p = 0; p < PAT_COUNT; p++)
+            if (!is_write(p))
+                patterns[npatterns++] = p;
+        fprintf(stderr, "%s is a block device: running read patterns only (use -p to write)\n", cfg.path);
+    }
+    printf("%s: %" PRIu64 " MiB, %.1f s per run%s\n", cfg.path, cfg.size >> 20, cfg.runtime,
+           cfg.keep_cache ? ", page cache kept" : ", page cache dropped before each run");
+    printf("%-12s %-9s %7s %5s %4s %9s %9s %9s %9s %9s %9s\n", "engine", "pattern", "bs", "qd", "thr", "MiB/s",
+           "IOPS", "p50 us", "p99 us", "p99.9 us", "max us");
+    for (int e = 0; e < nengines; e++)
+        for (int p = 0; p < npatterns; p++)
+            for (int b = 0; b < nsizes; b++)
+                run_one(&cfg, engines[e], patterns[p], sizes[b]);
+    return 0;
+}
+
+/*Explanation:
+Build: gcc -O2 iobench.c -o iobench -lpthread
+
+Usage: ./iobench /mnt/disk/bench.dat                     (every engine, pattern and size; 2 s each)
+       ./iobench -e uring-direct -p randread -b 4k -q 64 -t 4 -s 4g /mnt/disk/bench.dat
+       ./iobench -e buffered,mmap -p read -b 4k,1m -C bench.dat    (page cache kept: memory speed)
+
+open.c, read.c, lseek.c and write_call.c each make one system call and print what came back.
+iobench makes the same calls in a loop for a fixed time and measures them. pread()/pwrite() are
+used for every access: they are lseek() and read()/write() in one call, so threads can share a
+descriptor. Each line of output is one run of one engine, access pattern and block size:
+
+- engines: "buffered" is pread/pwrite through the page cache. "direct" is the same with O_DIRECT
+  (block sizes must then suit the device, normally a multiple of 4 KiB; on a filesystem that
+  refuses O_DIRECT the run says so). "mmap" copies to and from a shared mapping and
+  lets page faults do the I/O. "uring" and "uring-direct" keep -q requests in flight per thread
+  with io_uring (through uring_reader.h's ring layer); the others have one request in flight per
+  thread, so use -t to compare them at the same concurrency.
+- patterns: read and write run sequentially, each thread over its own slice of the file.
+  randread and randwrite pick uniformly random block-aligned offsets over the whole file.
+- MiB/s and IOPS: completed requests over the run's wall time. For writes that time includes
+  the fdatasync() (msync() for mmap) at the end, so dirty pages left in the cache aren't
+  counted as written.
+- latency: from issuing a request to its completion (for uring, queueing included), collected
+  in a histogram of 32 buckets per power of two, so percentiles are within about 3%.
+
+A regular file is created (or extended) to -s bytes of real data first. A block device is used
+as it is, up to its size (from the BLKGETSIZE64 ioctl); it is never laid out, and only the read
+patterns run on it unless write patterns are named with -p, since those overwrite the device.
+Anything else (a pipe, a character device) is refused. Before each run the file's
+pages are written back and dropped from the page cache with posix_fadvise(), so reads start
+from the device; -C skips this to measure the cache instead.*/
@@ -0,0 +1,292 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "simdscan.h"
+
+#define LIDX_MAGIC 0x5844494c // "LIDX"
+#define LIDX_VERSION 1
+#define DEFAULT_STRIDE 256    // lines per index entry
+#define SCAN_SIZE (1 << 20)   // bytes per pread() while indexing
+#define LOOKUP_SIZE (1 << 16) // bytes per pread() while looking up
+#define ENTRY_BATCH 4096      // new entries per pwrite() to the sidecar
+#define TAIL_WINDOW 4096      // bytes before the indexed end that must not change
+
+// The sidecar: this header, then entries[] where entries[j] is the byte offset of line
+// j * stride + 1. Entry 0 is always 0. Native byte order, mmappable as uint64_t[].
+struct lidx_header {
+    uint32_t magic, version;
+    uint64_t stride;
+    uint64_t size;      // bytes of the file indexed so far
+    uint64_t lines;     // '\n' bytes in them
+    uint64_t entries;   // = lines / stride + 1
+    uint64_t dev, ino;  // the indexed file
+    uint64_t tail_sum;  // FNV-1a of the TAIL_WINDOW bytes before size
+};
+
+_Static_assert(sizeof(struct lidx_header) == 64, "lidx header layout changed");
+
+static void fail(const char *what) {
+    perror(what);
+    exit(EXIT_FAILURE);
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// FNV-1a of the (up to) TAIL_WINDOW bytes before end: tells "appended to" from "rewritten"
+static uint64_t tail_sum(int fd, uint64_t end) {
+    unsigned char buf[TAIL_WINDOW];
+    uint64_t start = end > TAIL_WINDOW ? end - TAIL_WINDOW : 0, h = 0xcbf29ce484222325ULL;
+    ssize_t n = pread(fd, buf, end - start, start);
+    if (n != (ssize_t)(end - start))
+        return 0;
+    for (ssize_t i = 0; i < n; i++)
+        h = (h ^ buf[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static void write_all(int fd, const void *buf, size_t len, off_t off) {
+    if (pwrite(fd, buf, len, off) != (ssize_t)len)
+        fail("write index");
+}
+
+// Bring the sidecar up to date with the file: extend it if the file only grew, else rebuild
+static void update_index(int fd, const struct stat *st, int ifd, struct lidx_header *h, uint64_t stride) {
+    int fresh = pread(ifd, h, sizeof(*h), 0) != sizeof(*h) || h->magic != LIDX_MAGIC ||
+                h->version != LIDX_VERSION || h->stride == 0 || (stride && h->stride != stride) ||
+                h->dev != (uint64_t)st->st_dev || h->ino != (uint64_t)st->st_ino ||
+                h->size > (uint64_t)st->st_size || h->tail_sum != tail_sum(fd, h->size);
+    if (fresh) {
+        memset(h, 0, sizeof(*h));
+        h->magic = LIDX_MAGIC;
+        h->version = LIDX_VERSION;
+        h->stride = stride ? stride : DEFAULT_STRIDE;
+        h->entries = 1;
+        h->dev = st->st_dev;
+        h->ino = st->st_ino;
+        uint64_t zero = 0;
+        if (ftruncate(ifd, sizeof(*h)) == -1)
+            fail("truncate index");
+        write_all(ifd, &zero, sizeof(zero), sizeof(*h));
+    }
+    if (h->size == (uint64_t)st->st_size && !fresh)
+        return;
+
+    double t0 = now();
+    uint64_t from = h->size, added = 0;
+    unsigned char *buf = malloc(SCAN_SIZE);
+    uint64_t *batch = malloc(ENTRY_BATCH * sizeof(uint64_t));
+    size_t nbatch = 0;
+    if (buf == NULL || batch == NULL)
+        fail("malloc");
+    uint64_t k = h->stride - h->lines % h->stride; // newlines until the next sampled line
+    while (h->size < (uint64_t)st->st_size) {
+        size_t want = st->st_size - h->size < SCAN_SIZE ? st->st_size - h->size : SCAN_SIZE;
+        ssize_t n = pread(fd, buf, want, h->size);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fail("read");
+        if (n == 0)
+            break; // shrank while we read; the next run rebuilds
+        for (size_t i = 0; i < (size_t)n;) {
+            uint64_t before = k;
+            size_t at = scan_skip_lines(buf + i, n - i, &k);
+            if (at == SIZE_MAX) {
+                h->lines += before - k;
+                break;
+            }
+            h->lines += before;
+            i += at;
+            k = h->stride;
+            batch[nbatch++] = h->size + i;
+            if (nbatch == ENTRY_BATCH) {
+                write_all(ifd, batch, nbatch * sizeof(uint64_t), sizeof(*h) + h->entries * sizeof(uint64_t));
+                h->entries += nbatch;
+                added += nbatch;
+                nbatch = 0;
+            }
+        }
+        h->size += n;
+    }
+    write_all(ifd, batch, nbatch * sizeof(uint64_t), sizeof(*h) + h->entries * sizeof(uint64_t));
+    h->entries += nbatch;
+    added += nbatch;
+    // Header last: if we die before this, the old header still describes a valid prefix
+    h->tail_sum = tail_sum(fd, h->size);
+    write_all(ifd, h, sizeof(*h), 0);
+    double secs = now() - t0;
+    fprintf(stderr, "%s %" PRIu64 " bytes in %.3f s (%.1f MiB/s, %s): %" PRIu64 " lines, %" PRIu64
+            " entries (+%" PRIu64 ")\n", fresh ? "indexed" : "extended by", h->size - from, secs,
+            secs > 0 ? (h->size - from) / secs / 1048576.0 : 0.0, scan_names[scan_level], h->lines,
+            h->entries, added);
+    free(buf);
+    free(batch);
+}
+
+// Print count lines starting at line 'line' (1-based); returns how many were printed
+static uint64_t print_lines(int fd, int ifd, const struct lidx_header *h, uint64_t line, uint64_t count) {
+    size_t maplen = sizeof(*h) + h->entries * sizeof(uint64_t);
+    const uint64_t *map = mmap(NULL, maplen, PROT_READ, MAP_SHARED, ifd, 0);
+    if (map == MAP_FAILED)
+        fail("mmap index");
+    const uint64_t *entries = map + sizeof(*h) / sizeof(uint64_t);
+    uint64_t j = (line - 1) / h->stride, skip = (line - 1) % h->stride;
+    uint64_t off = j < h->entries ? entries[j] : h->size;
+    munmap((void *)map, maplen);
+    if (j >= h->entries)
+        return 0;
+
+    // From the sampled line: skip up to stride - 1 lines, then copy out 'count' of them
+    unsigned char *buf = malloc(LOOKUP_SIZE);
+    if (buf == NULL)
+        fail("malloc");
+    uint64_t printed = 0, scanned = 0, k = count;
+    int partial = 0; // printed part of a line with no newline yet
+    while (k > 0) {
+        ssize_t n = pread(fd, buf, LOOKUP_SIZE, off);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            fail("read");
+        if (n == 0)
+            break;
+        scanned += n;
+        size_t i = 0;
+        if (skip > 0) {
+            size_t at = scan_skip_lines(buf, n, &skip);
+            if (at == SIZE_MAX) {
+                off += n;
+                continue;
+            }
+            i = at;
+        }
+        uint64_t before = k;
+        size_t at = scan_skip_lines(buf + i, n - i, &k);
+        size_t end = at == SIZE_MAX ? (size_t)n : i + at;
+        fwrite(buf + i, 1, end - i, stdout);
+        partial = at == SIZE_MAX && k > 0 && buf[n - 1] != '\n';
+        printed += before - k;
+        off += end;
+    }
+    if (partial) {
+        putchar('\n'); // the file's last line has no newline
+        printed++;
+    }
+    fprintf(stderr, "line %" PRIu64 ": entry %" PRIu64 " + %" PRIu64 " lines, %" PRIu64 " bytes read\n", line, j,
+            (line - 1) % h->stride, scanned);
+    free(buf);
+    return printed;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-k stride] [-K scalar|sse2|avx2] [-o index_file] <file> [line [count]]\n", prog);
+    fprintf(stderr, "  without a line: build or extend <file>.lidx and report\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t stride = 0;
+    const char *kernel = NULL, *index_path = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:K:o:")) != -1) {
+        switch (opt) {
+        case 'k':
+            stride = strtoull(optarg, NULL, 0);
+            if (stride == 0)
+                usage(argv[0]);
+            break;
+        case 'K':
+            kernel = optarg;
+            break;
+        case 'o':
+            index_path = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind >= argc || argc - optind > 3)
+        usage(argv[0]);
+    if (scan_init(kernel) == -1) {
+        fprintf(stderr, "unknown or unsupported kernel: %s\n", kernel);
+        exit(EXIT_FAILURE);
+    }
+    const char *path = argv[optind];
+    char *own_path = NULL;
+    if (index_path == NULL) {
+        own_path = malloc(strlen(path) + 6);
+        if (own_path == NULL)
+            fail("malloc");
+        sprintf(own_path, "%s.lidx", path);
+        index_path = own_path;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1)
+        fail(path);
+    if (!S_ISREG(st.st_mode)) {
+        fprintf(stderr, "%s: not a regular file\n", path);
+        exit(EXIT_FAILURE);
+    }
+    int ifd = open(index_path, O_RDWR | O_CREAT, 0644);
+    if (ifd == -1)
+        fail(index_path);
+
+    struct lidx_header h;
+    update_index(fd, &st, ifd, &h, stride);
+
+    int status = 0;
+    if (optind + 1 < argc) {
+        uint64_t line = strtoull(argv[optind + 1], NULL, 0);
+        uint64_t count = optind + 2 < argc ? strtoull(argv[optind + 2], NULL, 0) : 1;
+        if (line == 0 || count == 0)
+            usage(argv[0]);
+        if (print_lines(fd, ifd, &h, line, count) < count)
+            status = EXIT_FAILURE; // ran past the end of the file
+    } else {
+        printf("%" PRIu64 " lines, %" PRIu64 " bytes; %" PRIu64 " entries every %" PRIu64 " lines in %s\n",
+               h.lines, h.size, h.entries, h.stride, index_path);
+    }
+    if (fflush(stdout) == EOF)
+        fail("write output");
+    close(ifd);
+    close(fd);
+    free(own_path);
+    return status;
+}
+
+/*Explanation:
+Build: gcc -O2 lineindex.c -o lineindex
+
+Usage: ./lineindex big.log                   (build big.log.lidx, or extend it if big.log grew)
+       ./lineindex big.log 40000000          (print line 40,000,000)
+       ./lineindex big.log 40000000 20       (20 lines from there)
+       ./lineindex -k 64 big.log             (rebuild with an entry every 64 lines)
+
+read_call_tillend_inchunks.c reads from the start to the end. To reach line 40,000,000 that way
+every byte before it has to be read and every newline counted. lineindex does that once and keeps
+the byte offset of every stride-th line (default 256) in big.log.lidx: a 64-byte header, then a
+plain array of 64-bit offsets, which the lookup mmaps. Line N is then entries[(N-1)/stride], one
+pread() there, and a scan over fewer than stride lines. For 40 million lines the index is about
+1.2 MiB.
+
+Newlines are found with simdscan.h's scan_skip_lines(): AVX2 (or SSE2) compares 64 bytes at a time
+into a bit mask and popcounts it, and only the block holding the next sampled line is looked at
+bit by bit.
+
+The header records how many bytes were indexed, the line count, the file's device/inode and a
+checksum of the last 4 KiB indexed. When the file has only grown (a log being appended to), the
+next run scans just the new bytes and appends entries; if it was truncated or rewritten, the
+index is rebuilt.*/
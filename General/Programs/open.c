@@ -3,16 +3,21 @@
 #include<sys/types.h>
 #include<sys/stat.h>
 #include<fcntl.h>
+#include "bufio.h"
 int main()
 {
 int n,fd;
 char buff[50];
+struct bufio in,out;
 fd=open("test.txt",O_RDONLY); //opens test.txt in read mode and the file descriptor is saved in integer fd.
-printf("The file descriptor of the file is: %d\n",fd); // the value of the file descriptor is printed.
-n=read(fd,buff,10);//read 10 characters from the file pointed to by file descriptor fd and save them in buffer (buff)
-write(1,buff,n); //write on the screen from the buffer
-printf("\n hello");
-
-
-
-}
\ No newline at end of file
+bio_init(&in,fd,0); //the first read fills a whole buffer (256 KiB, or $BUFIO_SIZE) from the file
+bio_init(&out,1,0); //everything printed is collected here and written to the screen at the end
+bio_printf(&out,"The file descriptor of the file is: %d\n",fd); // the value of the file descriptor is printed.
+n=bio_read_exact(&in,buff,10);//read 10 characters from the file (out of the buffer) and save them in buff
+if(n>0)
+bio_write(&out,buff,n); //copy them to the output buffer
+bio_printf(&out,"\n hello");
+bio_flush(&out); //one write for all three pieces of output
+bio_free(&in);
+bio_free(&out);
+}
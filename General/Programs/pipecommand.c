@@ -1,98 +1,426 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "builtins.h"
 
-int main() {
-    int pipefd[2]; // File descriptors for the pipe
-    pid_t pid1, pid2;
+#define MAX_STAGES 16
+#define MAX_ARGS 32
+#define TAP_CHUNK (1 << 20)   // bytes moved per splice() call at a tap
 
-    // Create a pipe
-    if (pipe(pipefd) == -1) {
-        perror("pipe");
-        exit(EXIT_FAILURE);
+struct stage {
+    char *argv[MAX_ARGS + 1];
+    int argc;
+    const struct builtin *builtin; // NULL means fork + execvp
+    int in_fd, out_fd;
+    pid_t pid;
+    pthread_t thread;
+    int status;
+    struct timespec spawned, exited; // CLOCK_MONOTONIC
+    struct rusage ru;                // from wait4(), or RUSAGE_THREAD for builtins
+};
+
+// A tap sits on one stage boundary and moves the stream with splice(), never
+// copying it into user space. tee() duplicates it into a side output file.
+struct tap {
+    int from_fd;      // read end of the pipe the upstream stage writes
+    int to_fd;        // write end of the pipe the downstream stage reads
+    int side_fd;      // side output file, or -1
+    int dup_pipe[2];  // holds the tee()'d copy on its way to side_fd
+    long long bytes;
+    pthread_t thread;
+};
+
+// Split "cmd args | cmd args | ..." into stages; returns the number of stages
+static int parse_pipeline(char *line, struct stage *stages) {
+    int n = 0;
+    char *save_stage, *save_arg;
+    for (char *cmd = strtok_r(line, "|", &save_stage); cmd != NULL;
+         cmd = strtok_r(NULL, "|", &save_stage)) {
+        if (n == MAX_STAGES) {
+            fprintf(stderr, "too many pipeline stages (max %d)\n", MAX_STAGES);
+            return -1;
+        }
+        struct stage *st = &stages[n];
+        memset(st, 0, sizeof(*st));
+        for (char *arg = strtok_r(cmd, " \t\n", &save_arg); arg != NULL;
+             arg = strtok_r(NULL, " \t\n", &save_arg)) {
+            if (st->argc == MAX_ARGS) {
+                fprintf(stderr, "too many arguments (max %d)\n", MAX_ARGS);
+                return -1;
+            }
+            st->argv[st->argc++] = arg;
+        }
+        if (st->argc == 0) {
+            fprintf(stderr, "empty pipeline stage\n");
+            return -1;
+        }
+        st->builtin = bi_lookup(st->argc, st->argv);
+        n++;
     }
+    return n;
+}
 
-    // Fork the first child process to execute "who"
-    pid1 = fork();
-    if (pid1 < 0) {
-        perror("fork");
-        exit(EXIT_FAILURE);
-    } else if (pid1 == 0) {
-        // Child process 1: Execute "who"
-        // Redirect stdout to the write end of the pipe
-        close(pipefd[0]); // Close the read end
-        dup2(pipefd[1], STDOUT_FILENO); // Duplicate write end to stdout
-        close(pipefd[1]); // Close the original write end
-
-        // Execute "who"
-        execlp("who", "who", NULL);
-        perror("execlp who"); // If execlp fails
-        exit(EXIT_FAILURE);
+// Thread body for a builtin stage
+static void *builtin_thread(void *arg) {
+    struct stage *st = arg;
+    struct bi_in in;
+    struct bi_out out;
+
+    bi_in_fd(&in, st->in_fd);
+    if (bi_out_init(&out, st->out_fd, BI_BUF_SIZE) == -1) {
+        perror("malloc");
+        st->status = 1;
+    } else {
+        st->status = st->builtin->run(st->argc, st->argv, &in, &out);
+        bi_out_free(&out);
+    }
+    bi_in_free(&in);
+    getrusage(RUSAGE_THREAD, &st->ru);
+    clock_gettime(CLOCK_MONOTONIC, &st->exited);
+
+    // Closing our pipe ends is what delivers EOF downstream and EPIPE upstream
+    if (st->in_fd != STDIN_FILENO)
+        close(st->in_fd);
+    if (st->out_fd != STDOUT_FILENO)
+        close(st->out_fd);
+    return NULL;
+}
+
+// Move the duplicate that tee() left in dup_pipe into the side file
+static int drain_side(struct tap *tp, ssize_t n) {
+    while (n > 0) {
+        ssize_t w = splice(tp->dup_pipe[0], NULL, tp->side_fd, NULL, n, SPLICE_F_MOVE);
+        if (w <= 0)
+            return -1;
+        n -= w;
+    }
+    return 0;
+}
+
+// Thread body for a tap: relay one boundary until EOF or the reader goes away
+static void *tap_thread(void *arg) {
+    struct tap *tp = arg;
+    for (;;) {
+        ssize_t n = TAP_CHUNK;
+        if (tp->side_fd != -1) {
+            // Duplicate what is in the pipe without consuming it
+            n = tee(tp->from_fd, tp->dup_pipe[1], TAP_CHUNK, 0);
+            if (n <= 0)
+                break;
+            if (drain_side(tp, n) == -1) {
+                perror("splice side output");
+                close(tp->side_fd);
+                close(tp->dup_pipe[0]);
+                close(tp->dup_pipe[1]);
+                tp->side_fd = -1;
+            }
+        }
+        // Now consume the same bytes into the downstream pipe
+        ssize_t moved = 0;
+        do {
+            ssize_t m = splice(tp->from_fd, NULL, tp->to_fd, NULL, n - moved, SPLICE_F_MOVE);
+            if (m <= 0) {
+                n = m;
+                break;
+            }
+            moved += m;
+        } while (tp->side_fd != -1 && moved < n);
+        tp->bytes += moved;
+        if (n <= 0)
+            break; // 0: upstream finished, -1: downstream closed early (EPIPE)
     }
+    close(tp->from_fd);
+    close(tp->to_fd);
+    if (tp->side_fd != -1) {
+        // tee() copied a chunk before knowing whether downstream would take it all; when it
+        // stopped early, cut the side file back to the bytes that were actually delivered
+        if (ftruncate(tp->side_fd, tp->bytes) == -1)
+            perror("truncate side output");
+        close(tp->side_fd);
+        close(tp->dup_pipe[0]);
+        close(tp->dup_pipe[1]);
+    }
+    return NULL;
+}
 
-    // Fork the second child process to execute "wc -l"
-    pid2 = fork();
-    if (pid2 < 0) {
+// Fork and exec an external stage with its pipe ends on stdin/stdout
+static pid_t spawn_stage(struct stage *st) {
+    pid_t pid = fork();
+    if (pid < 0) {
         perror("fork");
         exit(EXIT_FAILURE);
-    } else if (pid2 == 0) {
-        // Child process 2: Execute "wc -l"
-        // Redirect stdin to the read end of the pipe
-        close(pipefd[1]); // Close the write end
-        dup2(pipefd[0], STDIN_FILENO); // Duplicate read end to stdin
-        close(pipefd[0]); // Close the original read end
-
-        // Execute "wc -l"
-        execlp("wc", "wc", "-l", NULL);
-        perror("execlp wc"); // If execlp fails
+    } else if (pid == 0) {
+        signal(SIGPIPE, SIG_DFL); // the executor ignores it, real tools expect the default
+        if (st->in_fd != STDIN_FILENO)
+            dup2(st->in_fd, STDIN_FILENO);
+        if (st->out_fd != STDOUT_FILENO)
+            dup2(st->out_fd, STDOUT_FILENO);
+        // every pipe was made with O_CLOEXEC, so the other ends vanish on exec
+        execvp(st->argv[0], st->argv);
+        perror(st->argv[0]); // If execvp fails
+        _exit(127);
+    }
+    return pid;
+}
+
+static double ms_between(const struct timespec *a, const struct timespec *b) {
+    return (b->tv_sec - a->tv_sec) * 1e3 + (b->tv_nsec - a->tv_nsec) / 1e6;
+}
+
+static double tv_ms(const struct timeval *tv) {
+    return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+// Append one tab-separated line per stage. Every line carries the run id, so
+// profiles from many runs can be concatenated and grouped with awk/sort.
+static void write_profile(const char *path, struct stage *stages, int n,
+                          struct tap *taps, int tapped, const struct timespec *t0) {
+    FILE *fp = strcmp(path, "-") == 0 ? stderr : fopen(path, "a");
+    if (fp == NULL) {
+        perror(path);
+        return;
+    }
+    if (ftell(fp) == 0)
+        fprintf(fp, "#run\tstage\tkind\tcmd\tstatus\tspawn_ms\texit_ms\twall_ms\tuser_ms"
+                    "\tsys_ms\tmaxrss_kb\tnvcsw\tnivcsw\tminflt\tmajflt\tout_bytes\n");
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    for (int i = 0; i < n; i++) {
+        struct stage *st = &stages[i];
+        struct rusage *ru = &st->ru;
+        fprintf(fp, "%lld.%d\t%d\t%s\t%s\t%d\t%.3f\t%.3f\t%.3f\t%.3f\t%.3f\t%ld\t%ld\t%ld\t%ld\t%ld\t%lld\n",
+                (long long)now.tv_sec, (int)getpid(), i, st->builtin ? "builtin" : "exec",
+                st->argv[0], st->status, ms_between(t0, &st->spawned), ms_between(t0, &st->exited),
+                ms_between(&st->spawned, &st->exited), tv_ms(&ru->ru_utime), tv_ms(&ru->ru_stime),
+                ru->ru_maxrss, ru->ru_nvcsw, ru->ru_nivcsw, ru->ru_minflt, ru->ru_majflt,
+                tapped && i < n - 1 ? taps[i].bytes : -1LL);
+    }
+    if (fp != stderr)
+        fclose(fp);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-m] [-T side_prefix] [\"cmd args | cmd args | ...\"]\n", prog);
+    fprintf(stderr, "  -m          meter: splice every boundary and report bytes per boundary\n");
+    fprintf(stderr, "  -T prefix   also tee() boundary i into the file prefix.i\n");
+    fprintf(stderr, "  -p file     append a per-stage resource profile to file (- for stderr)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    char line[4096] = "who | wc -l"; // the original demo pipeline
+    struct stage stages[MAX_STAGES];
+    int pipefd[MAX_STAGES][2]; // pipefd[i] connects stage i to stage i+1
+    int tappedfd[MAX_STAGES][2]; // with taps, the pipe from tap i into stage i+1
+    struct tap taps[MAX_STAGES];
+    int meter = 0, opt;
+    const char *side_prefix = NULL, *profile = NULL;
+    struct timespec t0;
+
+    while ((opt = getopt(argc, argv, "mT:p:")) != -1) {
+        if (opt == 'm')
+            meter = 1;
+        else if (opt == 'T')
+            side_prefix = optarg;
+        else if (opt == 'p')
+            profile = optarg;
+        else
+            usage(argv[0]);
+    }
+    if (argc - optind > 1)
+        usage(argv[0]);
+    if (optind < argc) {
+        strncpy(line, argv[optind], sizeof(line) - 1);
+        line[sizeof(line) - 1] = '\0';
+    }
+    int tapped = meter || side_prefix != NULL;
+
+    int n = parse_pipeline(line, stages);
+    if (n <= 0)
         exit(EXIT_FAILURE);
+
+    // Builtin threads must see EPIPE as an error instead of killing the executor
+    signal(SIGPIPE, SIG_IGN);
+    scan_init(NULL); // widest wc kernel for the builtin wc
+
+    // Create the pipes between stages
+    for (int i = 0; i < n - 1; i++) {
+        if (pipe2(pipefd[i], O_CLOEXEC) == -1) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        if (!tapped)
+            continue;
+
+        // A tapped boundary is two pipes with a splice() relay in between
+        struct tap *tp = &taps[i];
+        if (pipe2(tappedfd[i], O_CLOEXEC) == -1) {
+            perror("pipe");
+            exit(EXIT_FAILURE);
+        }
+        fcntl(pipefd[i][0], F_SETPIPE_SZ, TAP_CHUNK); // fewer, larger splices; best effort
+        fcntl(tappedfd[i][0], F_SETPIPE_SZ, TAP_CHUNK);
+        tp->from_fd = pipefd[i][0];
+        tp->to_fd = tappedfd[i][1];
+        tp->side_fd = -1;
+        tp->bytes = 0;
+        if (side_prefix != NULL) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s.%d", side_prefix, i);
+            tp->side_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+            if (tp->side_fd == -1) {
+                perror(path);
+                exit(EXIT_FAILURE);
+            }
+            if (pipe2(tp->dup_pipe, O_CLOEXEC) == -1) {
+                perror("pipe");
+                exit(EXIT_FAILURE);
+            }
+            fcntl(tp->dup_pipe[0], F_SETPIPE_SZ, TAP_CHUNK);
+        }
+        pipefd[i][0] = tappedfd[i][0]; // stage i+1 now reads what the tap forwards
     }
 
-    // Parent process
-    // Close both ends of the pipe
-    close(pipefd[0]);
-    close(pipefd[1]);
+    // Start the taps before the stages so no stage blocks on a full pipe
+    for (int i = 0; tapped && i < n - 1; i++) {
+        if (pthread_create(&taps[i].thread, NULL, tap_thread, &taps[i]) != 0) {
+            perror("pthread_create");
+            exit(EXIT_FAILURE);
+        }
+    }
 
-    // Wait for both child processes to finish
-    waitpid(pid1, NULL, 0);
-    waitpid(pid2, NULL, 0);
+    // Start every stage: builtins as threads, everything else as a child process
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int children = 0;
+    for (int i = 0; i < n; i++) {
+        struct stage *st = &stages[i];
+        st->in_fd = i == 0 ? STDIN_FILENO : pipefd[i - 1][0];
+        st->out_fd = i == n - 1 ? STDOUT_FILENO : pipefd[i][1];
+        clock_gettime(CLOCK_MONOTONIC, &st->spawned);
+        if (st->builtin != NULL) {
+            if (pthread_create(&st->thread, NULL, builtin_thread, st) != 0) {
+                perror("pthread_create");
+                exit(EXIT_FAILURE);
+            }
+        } else {
+            st->pid = spawn_stage(st);
+            children++;
+            // The child owns these ends now
+            if (st->in_fd != STDIN_FILENO)
+                close(st->in_fd);
+            if (st->out_fd != STDOUT_FILENO)
+                close(st->out_fd);
+        }
+    }
 
-    return 0;
+    // Reap children in the order they exit so every exit timestamp is accurate
+    while (children > 0) {
+        int wstatus;
+        struct rusage ru;
+        pid_t pid = wait4(-1, &wstatus, 0, &ru);
+        if (pid == -1) {
+            perror("wait4");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            struct stage *st = &stages[i];
+            if (st->builtin == NULL && st->pid == pid) {
+                clock_gettime(CLOCK_MONOTONIC, &st->exited);
+                st->ru = ru;
+                st->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+                children--;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++)
+        if (stages[i].builtin != NULL)
+            pthread_join(stages[i].thread, NULL);
+
+    for (int i = 0; tapped && i < n - 1; i++) {
+        pthread_join(taps[i].thread, NULL);
+        if (meter)
+            fprintf(stderr, "boundary %d (%s -> %s): %lld bytes\n", i,
+                    stages[i].argv[0], stages[i + 1].argv[0], taps[i].bytes);
+    }
+
+    if (profile != NULL)
+        write_profile(profile, stages, n, taps, tapped, &t0);
+
+    return stages[n - 1].status;
 }
 
 /*Explanation:
-Pipe Creation:
+Build: gcc pipecommand.c -o pipecommand -lpthread
+
+Usage: ./pipecommand                          runs the original "who | wc -l"
+       ./pipecommand "cat f1 | grep -F error | wc -l"
+       ./pipecommand -m -T /tmp/side "cat f1 | sort | uniq -c"
+       ./pipecommand -p prof.tsv "cat big | sort | uniq -c | sort -n | tail -5"
 
-A pipe is created using pipe(pipefd). It has two file descriptors:
+Pipeline Parsing:
 
-pipefd[0]: Read end of the pipe.
+The command line is split on '|' into stages and each stage on blanks into an argv array.
 
-pipefd[1]: Write end of the pipe.
+bi_lookup() (builtins.h) decides whether a stage can run in-process: cat, wc, head, tail, tee
+and grep with a fixed string. Anything else (like "who") is run with fork() + execvp().
 
-First Child Process (who):
+Pipe Creation:
+
+One pipe is created between every pair of neighbouring stages with pipe2(..., O_CLOEXEC).
+
+pipefd[i][0]: Read end, becomes the input of stage i+1.
+
+pipefd[i][1]: Write end, becomes the output of stage i.
 
-The first child process is created using fork().
+O_CLOEXEC matters because builtin threads share the executor's file descriptor table: without it
+every exec'd child would inherit the builtins' pipe ends and the readers would never see EOF.
 
-It closes the read end of the pipe (pipefd[0]) because it only needs to write to the pipe.
+Builtin Stages:
 
-It redirects its standard output (STDOUT_FILENO) to the write end of the pipe using dup2(pipefd[1], STDOUT_FILENO).
+A builtin runs as a thread (pthread_create) that reads its input pipe and writes its output pipe
+through the batching buffers in builtins.h, then closes both ends so its neighbours see EOF/EPIPE.
 
-It executes the who command using execlp("who", "who", NULL).
+wc -l counts newlines with memchr(), head/tail/grep locate lines with memchr/memrchr/memmem.
+A pipeline made only of builtins ("cat f | grep -F x | wc -l") makes no execve() call at all.
 
-Second Child Process (wc -l):
+Taps (-m, -T):
 
-The second child process is created using fork().
+With -m or -T every boundary becomes two pipes with a tap thread between them. The tap moves the
+data with splice(), which hands pipe buffer pages from one pipe to the other inside the kernel, so
+the stream never enters user space and the tap can count bytes per boundary for free.
 
-It closes the write end of the pipe (pipefd[1]) because it only needs to read from the pipe.
+With -T the tap first calls tee() to duplicate the pipe contents into a private pipe without
+consuming them, splice()s that copy into the file prefix.i, and then splice()s the original on.
 
-It redirects its standard input (STDIN_FILENO) to the read end of the pipe using dup2(pipefd[0], STDIN_FILENO).
+External Stages:
 
-It executes the wc -l command using execlp("wc", "wc", "-l", NULL).
+The child redirects stdin/stdout to its pipe ends with dup2(), restores the default SIGPIPE action
+and calls execvp(). The parent closes the ends it handed over.
 
 Parent Process:
 
-The parent process closes both ends of the pipe because it doesn’t need them.
+Reaps the children with wait4(-1, ...) as they exit, joins the builtin threads and exits with the
+status of the last stage, like a shell does.
+
+Profile (-p):
+
+wait4() returns the child's struct rusage along with its status: user and system CPU time, peak
+RSS, voluntary/involuntary context switches and minor/major page faults. Builtin threads record
+the same with getrusage(RUSAGE_THREAD) (ru_maxrss there is the whole executor's peak).
+Spawn and exit times are CLOCK_MONOTONIC offsets from the start of the pipeline.
+
+One tab-separated line per stage is appended to the profile file; out_bytes is filled in when
+taps are on (-m/-T), otherwise -1. To find the stage that dominates across many runs:
 
-It waits for both child processes to finish using waitpid().*/
\ No newline at end of file
+awk -F'\t' '!/^#/ {cpu[$4] += $9 + $10; wall[$4] += $8} END {for (c in cpu) print c, cpu[c], wall[c]}' prof.tsv*/
@@ -1,63 +1,905 @@
-#include <ctype.h>
+#define _GNU_SOURCE
+#include <dirent.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
- 
+#include "simdscan.h"
+#include "statsrec.h"
+#include "uring_reader.h"
+
+#define READ_SIZE (1 << 18)      // bytes per read()/pread() call, also the getdents64() buffer
+#define CHUNK_ALIGN (1 << 21)    // chunks start on 2 MiB boundaries
+#define PIPE_BATCH (1 << 20)     // pipe size asked for with F_SETPIPE_SZ, and bytes counted per batch
+#define SMALL_FILE (4 << 20)     // files up to this size are counted whole by one worker
+#define BATCH_FILES 64           // small files handed to a worker at a time
+#define DIRECT_ALIGN 4096        // O_DIRECT offset/length/buffer alignment (-D)
+#define MAX_THREADS 256
+#define RECORD_BATCH 4096        // stats records per O_APPEND write() (-b)
+#define SUM_WINDOW 4096          // bytes checksummed at each end of the counted prefix
+#define STATE_MAGIC 0x52575331   // "RWS1"
+#define STATE_VERSION 2
+
+struct counts {
+  uint64_t chars, letters, numbers;
+  struct scan_wc wc; // lines, words and UTF-8 characters (-w)
+  uint64_t *hist;    // 256 byte frequencies (-H), NULL otherwise
+};
+
+static int wc_mode;   // -w: wc-style counts instead of letters/numbers
+static int hist_mode; // -H: byte histogram and character-class summary
+static const char *state_dir; // -i: incremental state directory
+static int uring_mode;        // -u: read through io_uring instead of read()/mmap
+static unsigned uring_depth = 8; // -q: reads kept in flight per worker
+static int direct_mode;       // -D: open with O_DIRECT, bypassing the page cache
+static int stats_mode;        // -s: report throughput and page-cache residency
+static __thread struct ur_reader *thread_ur; // this worker's reader, NULL if io_uring is unavailable
+
+// One input file. Workers fill it in; only path, total and err survive for the report.
+struct file {
+  char *path;
+  int fd;
+  int regular;
+  int seekable;              // regular file or block device: pread, mmap and chunks work
+  int direct;                // opened with O_DIRECT (-D)
+  int dontneed;              // O_DIRECT was refused: drop pages with POSIX_FADV_DONTNEED instead
+  uint64_t cached_before;    // -s: pages of the file in the page cache before counting
+  uint64_t dev, ino;
+  off_t size;
+  struct timespec mtime;
+  off_t from;                // first byte counted by this run (after -i state)
+  const unsigned char *map;  // mapping of [map_off, size) shared by the chunks, or NULL
+  off_t map_off;
+  size_t map_len;
+  struct counts base;        // restored from the saved state
+  struct counts *parts;      // per-chunk results, merged in file order
+  int nparts, remaining;     // chunks not finished yet
+  struct counts total;
+  int err;                   // errno of the first failure
+};
+
+// Work items: a directory to list, a batch of files to open, or one chunk of a large file
+enum { ITEM_DIR, ITEM_FILES, ITEM_CHUNK };
+
+struct item {
+  struct item *next;
+  int kind;
+  char *paths[BATCH_FILES]; // ITEM_DIR uses paths[0]
+  int npaths;
+  struct file *file;        // ITEM_CHUNK: part 'part' is bytes [start, end)
+  int part;
+  off_t start, end;
+};
+
+// The shared pool: one FIFO of items and the list of every file seen
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  struct item *head, *tail;
+  long pending;          // items queued or being worked on; 0 means everything is done
+  int nthreads;
+  int chunked;           // mmap large files and split them into chunks
+  struct file **files;
+  size_t nfiles, cap;
+  uint64_t hist[256];    // histograms of finished files
+  size_t resumed;        // files continued from their -i state
+  uint64_t skipped;      // bytes those states saved us from reading
+  uint64_t read_bytes;   // -s: bytes counted by this run
+  uint64_t pages, cached_before, cached_after;
+  size_t fallbacks;      // files where O_DIRECT was refused
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER};
+
+static void *xcalloc(size_t n, size_t size) {
+  void *p = calloc(n, size);
+  if (p == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  return p;
+}
+
+static void counts_init(struct counts *c) {
+  *c = (struct counts){.wc = SCAN_WC_INIT};
+  if (hist_mode)
+    c->hist = xcalloc(256, sizeof(uint64_t));
+}
+
+static void count_block(const unsigned char *p, size_t n, struct counts *c) {
+  c->chars += n;
+  // 64 bytes at a time either way (simdscan.h)
+  if (wc_mode)
+    scan_wc(p, n, &c->wc);
+  if (hist_mode)
+    scan_histogram(p, n, c->hist); // private to this chunk, merged at the end
+  if (!wc_mode && !hist_mode)
+    scan_classify(p, n, &c->letters, &c->numbers);
+}
+
+// Append the counts of the next piece of the same file
+static void add_counts(struct counts *total, const struct counts *c) {
+  total->chars += c->chars;
+  total->letters += c->letters;
+  total->numbers += c->numbers;
+  // in order, so a word cut in two by a chunk boundary is counted once
+  scan_wc_merge(&total->wc, &c->wc);
+  for (int b = 0; c->hist != NULL && b < 256; b++)
+    total->hist[b] += c->hist[b];
+}
+
+// Add another file's counts: words never continue across files, like wc's total line
+static void sum_counts(struct counts *total, const struct counts *c) {
+  total->chars += c->chars;
+  total->letters += c->letters;
+  total->numbers += c->numbers;
+  total->wc.lines += c->wc.lines;
+  total->wc.words += c->wc.words;
+  total->wc.utf8 += c->wc.utf8;
+}
+
+// Histogram mode output: class summary, then one line per byte value
+static char *format_histogram(const struct counts *c, int *len) {
+  static const struct { const char *name; int lo, hi; } classes[] = {
+    {"NUL", 0, 0},         {"Control", 1, 8},     {"Whitespace", 9, 13},
+    {"Control", 14, 31},   {"Whitespace", 32, 32}, {"Punctuation", 33, 47},
+    {"Digits", 48, 57},    {"Punctuation", 58, 64}, {"Uppercase", 65, 90},
+    {"Punctuation", 91, 96}, {"Lowercase", 97, 122}, {"Punctuation", 123, 126},
+    {"Control", 127, 127}, {"Non-ASCII", 128, 255},
+  };
+  static const char *order[] = {"NUL", "Control", "Whitespace", "Digits", "Uppercase",
+                                "Lowercase", "Punctuation", "Non-ASCII"};
+  char *out = malloc(16384);
+  int n = snprintf(out, 16384, "Bytes: %" PRIu64 "\n", c->chars);
+  for (size_t k = 0; k < sizeof(order) / sizeof(order[0]); k++) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); i++)
+      for (int b = classes[i].lo; strcmp(classes[i].name, order[k]) == 0 && b <= classes[i].hi; b++)
+        sum += c->hist[b];
+    n += snprintf(out + n, 16384 - n, "%s: %" PRIu64 "\n", order[k], sum);
+  }
+  n += snprintf(out + n, 16384 - n, "Histogram:\n");
+  for (int b = 0; b < 256; b++)
+    n += snprintf(out + n, 16384 - n, "0x%02x %" PRIu64 "\n", b, c->hist[b]);
+  *len = n;
+  return out;
+}
+
+
+// read() from the current offset to EOF
+static int count_stream(int fd, unsigned char *buf, struct counts *c) {
+  ssize_t n;
+  while ((n = read(fd, buf, READ_SIZE)) > 0)
+    count_block(buf, n, c);
+  return n < 0 ? -1 : 0;
+}
+
+// Pipes and sockets: grow the pipe so the writer can run further ahead, then
+// gather PIPE_BATCH bytes per count_block() instead of one pipe page at a time
+static int count_pipe(int fd, struct counts *c) {
+  // Fails harmlessly for sockets, or above /proc/sys/fs/pipe-max-size
+  fcntl(fd, F_SETPIPE_SZ, PIPE_BATCH);
+  unsigned char *big = xcalloc(1, PIPE_BATCH);
+  size_t have = 0;
+  for (;;) {
+    ssize_t n = read(fd, big + have, PIPE_BATCH - have);
+    if (n > 0 && (have += n) < PIPE_BATCH)
+      continue;
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (have > 0)
+      count_block(big, have, c);
+    have = 0;
+    if (n <= 0) {
+      int err = errno;
+      free(big);
+      errno = err;
+      return n < 0 ? -1 : 0;
+    }
+  }
+}
+
+// O_DIRECT refused (tmpfs, some network file systems, unaligned devices):
+// carry on buffered, but drop what was read so the cache still stays clean
+static void direct_fallback(struct file *f) {
+  if (!__atomic_exchange_n(&f->direct, 0, __ATOMIC_RELAXED))
+    return;
+  fcntl(f->fd, F_SETFL, fcntl(f->fd, F_GETFL) & ~O_DIRECT);
+  __atomic_store_n(&f->dontneed, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&pool.fallbacks, 1, __ATOMIC_RELAXED);
+}
+
+// Bytes [start, end) of a seekable file, end -1 meaning up to EOF. With -u the
+// worker's io_uring reader keeps several reads in flight; otherwise pread(),
+// which keeps no shared file offset, so chunks of one file never disturb each other.
+// O_DIRECT reads are widened to DIRECT_ALIGN boundaries and only [start, end) is counted.
+static int count_range(struct file *f, off_t start, off_t end, unsigned char *buf, struct counts *c) {
+  for (;;) {
+    int direct = __atomic_load_n(&f->direct, __ATOMIC_RELAXED);
+    off_t pos = start, stop = end;
+    if (direct) {
+      pos &= ~(off_t)(DIRECT_ALIGN - 1);
+      if (stop >= 0)
+        stop = (stop + DIRECT_ALIGN - 1) & ~(off_t)(DIRECT_ALIGN - 1);
+    }
+    const unsigned char *p = buf;
+    ssize_t n;
+    if (thread_ur != NULL)
+      ur_start(thread_ur, f->fd, pos, stop);
+    for (;;) {
+      if (thread_ur != NULL)
+        n = ur_next(thread_ur, &p);
+      else if (stop >= 0 && pos >= stop)
+        n = 0;
+      else
+        n = pread(f->fd, buf, stop >= 0 && stop - pos < READ_SIZE ? stop - pos : READ_SIZE, pos);
+      if (n <= 0)
+        break;
+      off_t lo = pos > start ? pos : start;
+      off_t hi = end >= 0 && pos + n > end ? end : pos + n;
+      if (hi > lo) {
+        count_block(p + (lo - pos), hi - lo, c);
+        start = hi; // a retry after a fallback resumes here
+      }
+      if (__atomic_load_n(&f->dontneed, __ATOMIC_RELAXED))
+        posix_fadvise(f->fd, pos, n, POSIX_FADV_DONTNEED);
+      pos += n;
+    }
+    int err = errno;
+    if (thread_ur != NULL)
+      ur_stop(thread_ur);
+    if (n == -1 && err == EINVAL && direct) {
+      direct_fallback(f);
+      continue;
+    }
+    errno = err;
+    return n < 0 ? -1 : 0;
+  }
+}
+
+// Pages of [0, size) currently in the page cache (-s)
+static uint64_t resident_pages(int fd, off_t size) {
+  long page = sysconf(_SC_PAGESIZE);
+  if (size <= 0)
+    return 0;
+  void *m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED)
+    return 0;
+  size_t pages = (size + page - 1) / page;
+  unsigned char *vec = malloc(pages);
+  uint64_t n = 0;
+  if (vec != NULL && mincore(m, size, vec) == 0)
+    for (size_t i = 0; i < pages; i++)
+      n += vec[i] & 1;
+  free(vec);
+  munmap(m, size);
+  return n;
+}
+
+// Sidecar state for incremental counting (-i): everything needed to resume
+// counting a file at the byte where the previous run stopped
+struct state {
+  uint32_t magic, version;
+  uint32_t modes;             // counts are only reusable in the same -w/-H mode
+  uint64_t dev, ino;          // which file this state belongs to
+  uint64_t offset;            // bytes counted so far
+  uint64_t head_sum, tail_sum; // checksums of the first and last SUM_WINDOW bytes before offset
+  uint64_t chars, letters, numbers;
+  struct scan_wc wc;
+  uint64_t hist[256];
+};
+
+// FNV-1a over at most SUM_WINDOW bytes that end at 'end' (or start at 0 for the head)
+static uint64_t window_sum(int fd, off_t start, off_t end) {
+  unsigned char buf[SUM_WINDOW];
+  if (end - start > SUM_WINDOW)
+    start = end - SUM_WINDOW;
+  ssize_t n = pread(fd, buf, end - start, start);
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (ssize_t i = 0; i < n; i++)
+    h = (h ^ buf[i]) * 0x100000001b3ULL;
+  return n == end - start ? h : 0;
+}
+
+// The checksums pread() 4 KiB windows at any offset, which O_DIRECT refuses
+static int sum_fd(const struct file *f) {
+  return f->direct ? open(f->path, O_RDONLY) : f->fd;
+}
+
+static void state_path(char *path, size_t size, const struct file *f) {
+  snprintf(path, size, "%s/%llx-%llx.state", state_dir, (unsigned long long)f->dev,
+           (unsigned long long)f->ino);
+}
+
+// Restore the saved counts into f->base if they still describe a prefix of the file
+static void state_load(struct file *f) {
+  static __thread struct state s;
+  char path[4096];
+  state_path(path, sizeof(path), f);
+  int sfd = open(path, O_RDONLY);
+  if (sfd == -1)
+    return;
+  ssize_t n = read(sfd, &s, sizeof(s));
+  close(sfd);
+  if (n != sizeof(s) || s.magic != STATE_MAGIC || s.version != STATE_VERSION ||
+      s.modes != (uint32_t)(wc_mode | hist_mode << 1) || s.dev != f->dev || s.ino != f->ino)
+    return;
+  // Truncated, or rewritten in place: the old prefix is gone
+  if (s.offset > (uint64_t)f->size)
+    return;
+  off_t head_end = s.offset < SUM_WINDOW ? s.offset : SUM_WINDOW;
+  int fd = sum_fd(f);
+  int same = window_sum(fd, 0, head_end) == s.head_sum && window_sum(fd, 0, s.offset) == s.tail_sum;
+  if (fd != f->fd)
+    close(fd);
+  if (!same)
+    return;
+
+  f->from = s.offset;
+  f->base.chars = s.chars;
+  f->base.letters = s.letters;
+  f->base.numbers = s.numbers;
+  f->base.wc = s.wc;
+  if (hist_mode)
+    memcpy(f->base.hist, s.hist, sizeof(s.hist));
+  pthread_mutex_lock(&pool.lock);
+  pool.resumed++;
+  pool.skipped += s.offset;
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static void state_save(const struct file *f) {
+  static __thread struct state s;
+  char path[4096], tmp[4160];
+  const struct counts *c = &f->total;
+  memset(&s, 0, sizeof(s));
+  s.magic = STATE_MAGIC;
+  s.version = STATE_VERSION;
+  s.modes = wc_mode | hist_mode << 1;
+  s.dev = f->dev;
+  s.ino = f->ino;
+  s.offset = c->chars; // every byte before this one is in the counts
+  int fd = sum_fd(f);
+  s.head_sum = window_sum(fd, 0, s.offset < SUM_WINDOW ? s.offset : SUM_WINDOW);
+  s.tail_sum = window_sum(fd, 0, s.offset);
+  if (fd != f->fd)
+    close(fd);
+  s.chars = c->chars;
+  s.letters = c->letters;
+  s.numbers = c->numbers;
+  s.wc = c->wc;
+  if (hist_mode)
+    memcpy(s.hist, c->hist, sizeof(s.hist));
+
+  // Write a temporary file and rename it, so a crash never leaves half a state
+  mkdir(state_dir, 0755);
+  state_path(path, sizeof(path), f);
+  snprintf(tmp, sizeof(tmp), "%s.%d.%lx", path, (int)getpid(), (unsigned long)pthread_self());
+  int sfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (sfd == -1 || write(sfd, &s, sizeof(s)) != sizeof(s) || rename(tmp, path) == -1)
+    perror("save incremental state");
+  if (sfd != -1)
+    close(sfd);
+}
+
+static void pool_push(struct item *it) {
+  pthread_mutex_lock(&pool.lock);
+  it->next = NULL;
+  if (pool.tail != NULL)
+    pool.tail->next = it;
+  else
+    pool.head = it;
+  pool.tail = it;
+  pool.pending++;
+  pthread_cond_signal(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+// Next item, or NULL once the queue is empty and no running item can add more
+static struct item *pool_pop(void) {
+  pthread_mutex_lock(&pool.lock);
+  while (pool.head == NULL && pool.pending > 0)
+    pthread_cond_wait(&pool.cond, &pool.lock);
+  struct item *it = pool.head;
+  if (it != NULL && (pool.head = it->next) == NULL)
+    pool.tail = NULL;
+  pthread_mutex_unlock(&pool.lock);
+  return it;
+}
+
+static void pool_done(void) {
+  pthread_mutex_lock(&pool.lock);
+  if (--pool.pending == 0)
+    pthread_cond_broadcast(&pool.cond);
+  pthread_mutex_unlock(&pool.lock);
+}
+
+static struct file *add_file(const char *path) {
+  struct file *f = xcalloc(1, sizeof(*f));
+  f->path = strdup(path);
+  f->fd = -1;
+  pthread_mutex_lock(&pool.lock);
+  if (pool.nfiles == pool.cap) {
+    pool.cap = pool.cap ? pool.cap * 2 : 1024;
+    if ((pool.files = realloc(pool.files, pool.cap * sizeof(*pool.files))) == NULL) {
+      perror("malloc");
+      exit(EXIT_FAILURE);
+    }
+  }
+  pool.files[pool.nfiles++] = f;
+  pthread_mutex_unlock(&pool.lock);
+  return f;
+}
+
+// Called once per file, by whichever worker finished its last chunk
+static void finish_file(struct file *f) {
+  f->total = f->base;
+  for (int i = 0; i < f->nparts; i++) {
+    add_counts(&f->total, &f->parts[i]);
+    free(f->parts[i].hist);
+  }
+  if (f->err == 0 && state_dir != NULL && f->regular && strcmp(f->path, "-") != 0)
+    state_save(f);
+  uint64_t cached_after = stats_mode && f->seekable ? resident_pages(f->fd, f->size) : 0;
+  pthread_mutex_lock(&pool.lock);
+  for (int b = 0; f->err == 0 && hist_mode && b < 256; b++)
+    pool.hist[b] += f->total.hist[b];
+  pool.read_bytes += f->total.chars - f->base.chars;
+  if (stats_mode && f->seekable) {
+    pool.pages += (f->size + sysconf(_SC_PAGESIZE) - 1) / sysconf(_SC_PAGESIZE);
+    pool.cached_before += f->cached_before;
+    pool.cached_after += cached_after;
+  }
+  pthread_mutex_unlock(&pool.lock);
+  free(f->total.hist);
+  f->total.hist = NULL;
+  free(f->parts);
+  f->parts = NULL;
+  if (f->map != NULL)
+    munmap((void *)f->map, f->map_len);
+  if (f->fd != -1)
+    close(f->fd);
+}
+
+// Open a file ("-" is stdin) and either count it right here or queue its chunks
+static void start_file(const char *path, unsigned char *buf) {
+  struct file *f = add_file(path);
+  struct stat st;
+  int is_stdin = strcmp(path, "-") == 0;
+  f->fd = is_stdin ? dup(STDIN_FILENO) : open(path, O_RDONLY | (direct_mode ? O_DIRECT : 0));
+  f->direct = direct_mode && !is_stdin && f->fd != -1;
+  if (f->fd == -1 && direct_mode && errno == EINVAL) {
+    f->fd = open(path, O_RDONLY); // this file system has no O_DIRECT at all
+    f->dontneed = 1;
+    __atomic_add_fetch(&pool.fallbacks, 1, __ATOMIC_RELAXED);
+  }
+  if (f->fd == -1 || fstat(f->fd, &st) == -1) {
+    f->err = errno;
+    finish_file(f);
+    return;
+  }
+  f->regular = S_ISREG(st.st_mode);
+  f->seekable = f->regular || S_ISBLK(st.st_mode);
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->size = st.st_size;
+  f->mtime = st.st_mtim;
+  uint64_t bytes;
+  if (S_ISBLK(st.st_mode) && ioctl(f->fd, BLKGETSIZE64, &bytes) == 0)
+    f->size = bytes; // st_size is 0 for devices
+  if (stats_mode && f->seekable)
+    f->cached_before = resident_pages(f->fd, f->size);
+  counts_init(&f->base);
+  if (is_stdin && f->seekable) {
+    // "tool < file": count from wherever the shell left the offset, like wc
+    off_t cur = lseek(f->fd, 0, SEEK_CUR);
+    f->from = cur > 0 && cur <= f->size ? cur : 0;
+  } else if (state_dir != NULL && f->regular) {
+    state_load(f); // sets f->from when the file only grew
+  }
+
+  // Small files, pipes and size-0 "regular" files (/proc, /sys): counted in one go
+  off_t todo = f->size - f->from;
+  if (!pool.chunked || !f->seekable || f->size == 0 || todo <= SMALL_FILE) {
+    f->parts = xcalloc(1, sizeof(struct counts));
+    f->nparts = 1;
+    counts_init(&f->parts[0]);
+    int r;
+    if (f->seekable && f->size > 0)
+      r = count_range(f, f->from, f->regular ? -1 : f->size, buf, &f->parts[0]);
+    else if (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode))
+      r = count_pipe(f->fd, &f->parts[0]);
+    else
+      r = (f->from > 0 && lseek(f->fd, f->from, SEEK_SET) == -1) ? -1 : count_stream(f->fd, buf, &f->parts[0]);
+    if (r == -1)
+      f->err = errno;
+    finish_file(f);
+    return;
+  }
+
+  // Large file: map it once (or read it with pread/io_uring/O_DIRECT) and hand out chunks
+  f->map_off = f->from & ~(off_t)(sysconf(_SC_PAGESIZE) - 1); // mmap offsets are page aligned
+  f->map_len = f->size - f->map_off;
+  void *map = uring_mode || direct_mode ? MAP_FAILED : mmap(NULL, f->map_len, PROT_READ, MAP_PRIVATE, f->fd, f->map_off);
+  if (map != MAP_FAILED) {
+    madvise(map, f->map_len, MADV_SEQUENTIAL);
+    f->map = map;
+  }
+  // A few chunks per worker, so one big file next to many small ones still balances
+  off_t per = (todo / (pool.nthreads * 4) + CHUNK_ALIGN - 1) / CHUNK_ALIGN * CHUNK_ALIGN;
+  if (per == 0)
+    per = CHUNK_ALIGN;
+  f->nparts = (todo + per - 1) / per;
+  f->remaining = f->nparts;
+  f->parts = xcalloc(f->nparts, sizeof(struct counts));
+  for (int i = 0; i < f->nparts; i++) {
+    struct item *it = xcalloc(1, sizeof(*it));
+    counts_init(&f->parts[i]);
+    it->kind = ITEM_CHUNK;
+    it->file = f;
+    it->part = i;
+    it->start = f->from + (off_t)i * per;
+    it->end = it->start + per < f->size ? it->start + per : f->size;
+    pool_push(it);
+  }
+}
+
+static void run_chunk(struct item *it, unsigned char *buf) {
+  struct file *f = it->file;
+  struct counts *c = &f->parts[it->part];
+  if (f->map != NULL)
+    count_block(f->map + (it->start - f->map_off), it->end - it->start, c);
+  else if (count_range(f, it->start, it->end, buf, c) == -1)
+    __atomic_store_n(&f->err, errno, __ATOMIC_RELAXED);
+  // The last chunk to finish merges them all
+  if (__atomic_sub_fetch(&f->remaining, 1, __ATOMIC_ACQ_REL) == 0)
+    finish_file(f);
+}
+
+static char *join_path(const char *dir, const char *name) {
+  size_t dlen = strlen(dir), nlen = strlen(name);
+  char *p = xcalloc(1, dlen + nlen + 2);
+  memcpy(p, dir, dlen);
+  if (dlen > 0 && dir[dlen - 1] != '/')
+    p[dlen++] = '/';
+  memcpy(p + dlen, name, nlen);
+  return p;
+}
+
+struct linux_dirent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+// List one directory with getdents64(): subdirectories become new items,
+// regular files are queued in batches of BATCH_FILES
+static void walk_dir(const char *path, unsigned char *buf) {
+  int dfd = open(path, O_RDONLY | O_DIRECTORY);
+  if (dfd == -1) {
+    int err = errno;
+    add_file(path)->err = err;
+    return;
+  }
+  struct item *batch = NULL;
+  long n;
+  while ((n = syscall(SYS_getdents64, dfd, buf, READ_SIZE)) > 0) {
+    for (long off = 0; off < n;) {
+      struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+      off += d->d_reclen;
+      if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0)
+        continue;
+      unsigned char type = d->d_type;
+      struct stat st;
+      // d_type is a hint some file systems leave unset
+      if (type == DT_UNKNOWN && fstatat(dfd, d->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0)
+        type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+      // Symbolic links, devices and sockets are skipped, like find -type f
+      if (type != DT_DIR && type != DT_REG)
+        continue;
+
+      char *child = join_path(path, d->d_name);
+      if (type == DT_DIR) {
+        struct item *it = xcalloc(1, sizeof(*it));
+        it->kind = ITEM_DIR;
+        it->paths[it->npaths++] = child;
+        pool_push(it);
+        continue;
+      }
+      if (batch == NULL) {
+        batch = xcalloc(1, sizeof(*batch));
+        batch->kind = ITEM_FILES;
+      }
+      batch->paths[batch->npaths++] = child;
+      if (batch->npaths == BATCH_FILES) {
+        pool_push(batch);
+        batch = NULL;
+      }
+    }
+  }
+  if (n == -1) {
+    int err = errno;
+    add_file(path)->err = err;
+  }
+  if (batch != NULL)
+    pool_push(batch);
+  close(dfd);
+}
+
+static void *worker(void *arg) {
+  (void)arg;
+  unsigned char *buf; // read() buffer and getdents64() buffer, aligned for O_DIRECT
+  if (posix_memalign((void **)&buf, DIRECT_ALIGN, READ_SIZE) != 0) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  static int warned;
+  struct ur_reader *ur = NULL;
+  if (uring_mode) {
+    // One ring per worker, reused for every file it reads
+    ur = xcalloc(1, sizeof(*ur));
+    if (ur_init(ur, uring_depth, READ_SIZE) == 0)
+      thread_ur = ur;
+    else if (__atomic_exchange_n(&warned, 1, __ATOMIC_RELAXED) == 0)
+      perror("io_uring unavailable, using pread()");
+  }
+  struct item *it;
+  while ((it = pool_pop()) != NULL) {
+    if (it->kind == ITEM_DIR)
+      walk_dir(it->paths[0], buf);
+    else if (it->kind == ITEM_FILES)
+      for (int i = 0; i < it->npaths; i++)
+        start_file(it->paths[i], buf);
+    else
+      run_chunk(it, buf);
+    for (int i = 0; i < it->npaths; i++)
+      free(it->paths[i]);
+    free(it);
+    pool_done();
+  }
+  if (thread_ur != NULL)
+    ur_free(thread_ur);
+  free(ur);
+  free(buf);
+  return NULL;
+}
+
+// -b: one fixed-size binary record per file, appended in whole-record writes
+// so concurrent runs can share one file without locking (statsrec.h)
+static void append_records(const char *path) {
+  int fd = open(path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+  if (fd == -1) {
+    perror("open stats record file");
+    exit(EXIT_FAILURE);
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  struct statsrec *recs = xcalloc(RECORD_BATCH, sizeof(*recs));
+  size_t n = 0;
+  for (size_t i = 0; i <= pool.nfiles; i++) {
+    if (n == RECORD_BATCH || (i == pool.nfiles && n > 0)) {
+      ssize_t len = n * sizeof(*recs);
+      if (write(fd, recs, len) != len) {
+        perror("write stats records");
+        exit(EXIT_FAILURE);
+      }
+      n = 0;
+    }
+    if (i == pool.nfiles || pool.files[i]->err != 0)
+      continue;
+    const struct file *f = pool.files[i];
+    struct statsrec *r = &recs[n++];
+    memset(r, 0, sizeof(*r));
+    r->magic = STATSREC_MAGIC;
+    r->version = STATSREC_VERSION;
+    r->flags = (wc_mode ? STATSREC_WC : 0) | (!wc_mode && !hist_mode ? STATSREC_CLASSIFY : 0);
+    r->dev = f->dev;
+    r->ino = f->ino;
+    r->size = f->size;
+    r->mtime_sec = f->mtime.tv_sec;
+    r->mtime_nsec = f->mtime.tv_nsec;
+    r->counted_at = now.tv_sec * 1000000000LL + now.tv_nsec;
+    r->counters[STATSREC_BYTES] = f->total.chars;
+    r->counters[STATSREC_LETTERS] = f->total.letters;
+    r->counters[STATSREC_NUMBERS] = f->total.numbers;
+    r->counters[STATSREC_LINES] = f->total.wc.lines;
+    r->counters[STATSREC_WORDS] = f->total.wc.words;
+    r->counters[STATSREC_UTF8] = f->total.wc.utf8;
+  }
+  free(recs);
+  close(fd);
+}
+
+static int by_path(const void *a, const void *b) {
+  return strcmp((*(struct file *const *)a)->path, (*(struct file *const *)b)->path);
+}
+
+// Multi-file output: one line per file, like wc with several operands
+static void print_file(FILE *out, const struct file *f) {
+  const struct counts *c = &f->total;
+  if (wc_mode)
+    fprintf(out, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %s\n", c->wc.lines, c->wc.words,
+            c->chars, c->wc.utf8, f->path);
+  else if (hist_mode)
+    fprintf(out, "%" PRIu64 " %s\n", c->chars, f->path);
+  else
+    fprintf(out, "%" PRIu64 " %" PRIu64 " %" PRIu64 " %s\n", c->chars, c->letters, c->numbers, f->path);
+}
+
 int main(int argc, char *argv[]) {
-  if (argc != 3) {
-    fprintf(stderr, "Usage: %s <input_file> <output_file>\n", argv[0]);
+  const char *kernel = NULL; // NULL: best one the CPU supports
+  const char *record_file = NULL;
+  int nthreads = -1;         // -1: no -t given
+  int opt, bad_usage = 0;
+  while ((opt = getopt(argc, argv, "Db:Hi:k:q:st:uw")) != -1) {
+    if (opt == 'i')
+      state_dir = optarg;
+    else if (opt == 'w')
+      wc_mode = 1;
+    else if (opt == 'H')
+      hist_mode = 1;
+    else if (opt == 'k')
+      kernel = optarg;
+    else if (opt == 'u')
+      uring_mode = 1;
+    else if (opt == 'D')
+      direct_mode = 1;
+    else if (opt == 's')
+      stats_mode = 1;
+    else if (opt == 'b')
+      record_file = optarg;
+    else if (opt == 'q')
+      uring_depth = atoi(optarg) > 0 ? atoi(optarg) : 1;
+    else if (opt == 't')
+      nthreads = atoi(optarg) > 0 ? atoi(optarg) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    else
+      bad_usage = 1;
+  }
+  if (bad_usage || argc - optind < 2) {
+    fprintf(stderr, "Usage: %s [-w] [-H] [-k scalar|sse2|avx2] [-t threads] [-u [-q depth]] [-D] [-s] [-i state_dir] [-b record_file] <input>... <output_file>\n", argv[0]);
+    fprintf(stderr, "  inputs may be files, directories (walked recursively) or - for stdin\n");
+    fprintf(stderr, "  -w    count lines, words, bytes and UTF-8 characters like wc\n");
+    fprintf(stderr, "  -H    byte histogram with character-class summary\n");
+    fprintf(stderr, "  -t N  worker threads, large files split into chunks (0 = one per CPU)\n");
+    fprintf(stderr, "  -u    read through io_uring, -q reads in flight per thread (default 8)\n");
+    fprintf(stderr, "  -D    O_DIRECT: read around the page cache\n");
+    fprintf(stderr, "  -s    report throughput and page-cache residency on stderr\n");
+    fprintf(stderr, "  -i D  incremental: keep state in directory D, count only appended bytes\n");
+    fprintf(stderr, "  -b F  also append one binary stats record per file to F (statsrec.h)\n");
     exit(EXIT_FAILURE);
   }
- 
-  char *input_file = argv[1];
-  char *output_file = argv[2];
- 
-  // Open input file
-  int input_fd = open(input_file, O_RDONLY);
-  if (input_fd == -1) {
-    perror("open input file");
+  if (scan_init(kernel) == -1) {
+    fprintf(stderr, "kernel '%s' is not available on this CPU\n", kernel);
     exit(EXIT_FAILURE);
   }
- 
+
+  char **inputs = argv + optind;
+  int ninputs = argc - optind - 1;
+  char *output_file = argv[argc - 1];
+
+  // Queue the operands: directories are listed by the workers, files go in batches
+  int multi = ninputs > 1;
+  struct item *batch = NULL;
+  for (int i = 0; i < ninputs; i++) {
+    struct stat st;
+    struct item *it;
+    if (stat(inputs[i], &st) == 0 && S_ISDIR(st.st_mode)) {
+      multi = 1;
+      it = xcalloc(1, sizeof(*it));
+      it->kind = ITEM_DIR;
+      it->paths[it->npaths++] = strdup(inputs[i]);
+      pool_push(it);
+      continue;
+    }
+    if (batch == NULL) {
+      batch = xcalloc(1, sizeof(*batch));
+      batch->kind = ITEM_FILES;
+    }
+    batch->paths[batch->npaths++] = strdup(inputs[i]);
+    if (batch->npaths == BATCH_FILES) {
+      pool_push(batch);
+      batch = NULL;
+    }
+  }
+  if (batch != NULL)
+    pool_push(batch);
+
+  // One file without -t keeps the classic single read() loop
+  pool.chunked = nthreads != -1 || multi;
+  pool.nthreads = nthreads != -1 ? nthreads : multi ? (int)sysconf(_SC_NPROCESSORS_ONLN) : 1;
+  if (pool.nthreads > MAX_THREADS)
+    pool.nthreads = MAX_THREADS;
+  pthread_t threads[MAX_THREADS];
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (int i = 0; i < pool.nthreads; i++)
+    if (pthread_create(&threads[i], NULL, worker, NULL) != 0) {
+      perror("pthread_create");
+      exit(EXIT_FAILURE);
+    }
+  for (int i = 0; i < pool.nthreads; i++)
+    pthread_join(threads[i], NULL);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+
+  if (stats_mode) {
+    // Run once with and once without -D: the "after" column is what each mode left in the cache
+    double secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    fprintf(stderr, "io: %" PRIu64 " bytes in %.3f s, %.1f MiB/s (%s%s%s)\n", pool.read_bytes, secs,
+            secs > 0 ? pool.read_bytes / secs / (1 << 20) : 0.0,
+            direct_mode ? "O_DIRECT" : pool.chunked && !uring_mode ? "mmap/buffered" : "buffered",
+            uring_mode ? ", io_uring" : "", pool.chunked ? ", chunked" : "");
+    fprintf(stderr, "page cache: %" PRIu64 " of %" PRIu64 " pages resident before, %" PRIu64 " after\n",
+            pool.cached_before, pool.pages, pool.cached_after);
+    if (pool.fallbacks > 0)
+      fprintf(stderr, "O_DIRECT refused for %zu files: read buffered with POSIX_FADV_DONTNEED\n", pool.fallbacks);
+  }
+
+  // Aggregate in path order, so the report does not depend on scheduling
+  qsort(pool.files, pool.nfiles, sizeof(*pool.files), by_path);
+  struct counts total = {.wc = SCAN_WC_INIT, .hist = pool.hist};
+  size_t counted = 0;
+  int status = 0;
+  for (size_t i = 0; i < pool.nfiles; i++) {
+    struct file *f = pool.files[i];
+    if (f->err != 0) {
+      fprintf(stderr, "%s: %s\n", f->path, strerror(f->err));
+      status = EXIT_FAILURE;
+      continue;
+    }
+    sum_counts(&total, &f->total);
+    counted++;
+  }
+  if (!multi && status != 0)
+    exit(EXIT_FAILURE);
+  if (state_dir != NULL)
+    fprintf(stderr, "incremental: %zu of %zu files resumed, %" PRIu64 " bytes not re-read\n",
+            pool.resumed, counted, pool.skipped);
+  if (record_file != NULL)
+    append_records(record_file);
+
   // Open output file
   int output_fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-  if (output_fd == -1) {
+  FILE *out = output_fd == -1 ? NULL : fdopen(output_fd, "w");
+  if (out == NULL) {
     perror("open output file");
-    close(input_fd);
-    exit(EXIT_FAILURE);
-  }
- 
-  char buffer[4096];
-  ssize_t bytes_read;
-  int chars = 0, letters = 0, numbers = 0;
- 
-  // Read and count
-  while ((bytes_read = read(input_fd, buffer, sizeof(buffer))) > 0) {
-    chars += bytes_read;
-    for (ssize_t i = 0; i < bytes_read; i++) {
-      if (isalpha(buffer[i]))
-        letters++;
-      if (isdigit(buffer[i]))
-        numbers++;
-    }
-  }
- 
-  close(input_fd);
-  // eyes
+    exit(EXIT_FAILURE);
+  }
+  if (multi) {
+    for (size_t i = 0; i < pool.nfiles; i++)
+      if (pool.files[i]->err == 0)
+        print_file(out, pool.files[i]);
+    fprintf(out, "Total (%zu files):\n", counted);
+  }
+
   //  Format output string
-  char output[100];
-  int len = snprintf(output, sizeof(output),
-                     "Characters: %d\nLetters: %d\nNumbers: %d\n", chars,
-                     letters, numbers);
- 
+  char *hist_text = NULL;
+  int hist_len = 0;
+  if (hist_mode)
+    hist_text = format_histogram(&total, &hist_len);
+  if (wc_mode)
+    fprintf(out, "Lines: %" PRIu64 "\nWords: %" PRIu64 "\nBytes: %" PRIu64 "\nUTF-8 characters: %" PRIu64 "\n",
+            total.wc.lines, total.wc.words, total.chars, total.wc.utf8);
+  else if (!hist_mode)
+    fprintf(out, "Characters: %" PRIu64 "\nLetters: %" PRIu64 "\nNumbers: %" PRIu64 "\n",
+            total.chars, total.letters, total.numbers);
+  if (hist_mode)
+    fwrite(hist_text, 1, hist_len, out);
+
   // Write to output file
-  if (write(output_fd, output, len) != len) {
+  if (ferror(out) || fclose(out) != 0) {
     perror("write output");
-    close(output_fd);
     exit(EXIT_FAILURE);
   }
- 
-  close(output_fd);
-  return 0;
-}
\ No newline at end of file
+  free(hist_text);
+  return status;
+}
@@ -0,0 +1,224 @@
+/*
+ * Fixed-size record store: record i lives at data_offset + i * record_size,
+ * so any record is one positioned read or write away.
+ *
+ * This is lseek.c's "seek, then read" turned into a library. All I/O uses
+ * pread()/pwrite()/preadv(), which take the offset as an argument instead
+ * of moving the descriptor's shared file offset, so any number of threads
+ * can read and write one store at the same time. Offsets are 64-bit
+ * throughout (off_t is 64-bit on every 64-bit Linux; 32-bit builds need
+ * -D_FILE_OFFSET_BITS=64), so stores can grow well past 4 GiB.
+ *
+ * File layout: one 4 KiB header page, then the records.
+ *
+ *     struct rs_header   magic, version, record_size, count, data_offset
+ *     record 0           record_size bytes
+ *     record 1 ...
+ *
+ * The header's count is written by rs_sync() and rs_close(). Appends past
+ * the saved count that were not synced before a crash are ignored on the
+ * next rs_open(). A failed append still takes its slot (left as written).
+ */
+#ifndef RECSTORE_H
+#define RECSTORE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define RS_MAGIC 0x31535352 // "RSS1"
+#define RS_VERSION 1
+#define RS_HEADER_SIZE 4096 // records start on a page boundary
+#define RS_IOV_MAX 1024     // iovecs per preadv() (IOV_MAX on Linux)
+
+_Static_assert(sizeof(off_t) == 8, "recstore needs a 64-bit off_t");
+
+struct rs_header {
+    uint32_t magic, version;
+    uint64_t record_size;
+    uint64_t count;
+    uint64_t data_offset;
+};
+
+struct recstore {
+    int fd;
+    uint64_t record_size;
+    uint64_t count;       // records readers can see
+    uint64_t reserved;    // slots handed out by rs_append(), >= count
+    off_t data_offset;
+};
+
+static inline off_t rs_offset(const struct recstore *rs, uint64_t index) {
+    return rs->data_offset + (off_t)(index * rs->record_size);
+}
+
+// Write the header with the current record count
+static inline int rs_sync(struct recstore *rs) {
+    struct rs_header h;
+    memset(&h, 0, sizeof(h));
+    h.magic = RS_MAGIC;
+    h.version = RS_VERSION;
+    h.record_size = rs->record_size;
+    h.count = __atomic_load_n(&rs->count, __ATOMIC_ACQUIRE);
+    h.data_offset = rs->data_offset;
+    return pwrite(rs->fd, &h, sizeof(h), 0) == sizeof(h) ? 0 : -1;
+}
+
+// New, empty store (an existing file is truncated)
+static inline int rs_create(struct recstore *rs, const char *path, uint64_t record_size) {
+    if (record_size == 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    rs->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (rs->fd == -1)
+        return -1;
+    rs->record_size = record_size;
+    rs->count = rs->reserved = 0;
+    rs->data_offset = RS_HEADER_SIZE;
+    if (ftruncate(rs->fd, RS_HEADER_SIZE) == -1 || rs_sync(rs) == -1) {
+        int err = errno;
+        close(rs->fd);
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+// Open an existing store; EINVAL if the header is not ours
+static inline int rs_open(struct recstore *rs, const char *path, int writable) {
+    struct rs_header h;
+    rs->fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (rs->fd == -1)
+        return -1;
+    if (pread(rs->fd, &h, sizeof(h), 0) != sizeof(h) || h.magic != RS_MAGIC ||
+        h.version != RS_VERSION || h.record_size == 0) {
+        close(rs->fd);
+        errno = EINVAL;
+        return -1;
+    }
+    rs->record_size = h.record_size;
+    rs->count = rs->reserved = h.count;
+    rs->data_offset = h.data_offset;
+    return 0;
+}
+
+static inline int rs_close(struct recstore *rs, int writable) {
+    int ret = writable ? rs_sync(rs) : 0;
+    if (close(rs->fd) == -1)
+        ret = -1;
+    return ret;
+}
+
+// Read record 'index' into rec (record_size bytes)
+static inline int rs_get(const struct recstore *rs, uint64_t index, void *rec) {
+    if (index >= __atomic_load_n(&rs->count, __ATOMIC_ACQUIRE)) {
+        errno = ERANGE;
+        return -1;
+    }
+    ssize_t n = pread(rs->fd, rec, rs->record_size, rs_offset(rs, index));
+    if (n == (ssize_t)rs->record_size)
+        return 0;
+    if (n >= 0)
+        errno = EIO; // the file is shorter than its header says
+    return -1;
+}
+
+// Overwrite existing record 'index'
+static inline int rs_put(struct recstore *rs, uint64_t index, const void *rec) {
+    if (index >= __atomic_load_n(&rs->count, __ATOMIC_ACQUIRE)) {
+        errno = ERANGE;
+        return -1;
+    }
+    return pwrite(rs->fd, rec, rs->record_size, rs_offset(rs, index)) == (ssize_t)rs->record_size ? 0 : -1;
+}
+
+// Append a record; safe from many threads at once. *index gets its position.
+static inline int rs_append(struct recstore *rs, const void *rec, uint64_t *index) {
+    // Claim a slot, fill it, then publish slots in order so readers never see a gap
+    uint64_t i = __atomic_fetch_add(&rs->reserved, 1, __ATOMIC_ACQ_REL);
+    int ret = pwrite(rs->fd, rec, rs->record_size, rs_offset(rs, i)) == (ssize_t)rs->record_size ? 0 : -1;
+    while (__atomic_load_n(&rs->count, __ATOMIC_ACQUIRE) != i)
+        sched_yield(); // an earlier append is still writing
+    __atomic_store_n(&rs->count, i + 1, __ATOMIC_RELEASE);
+    if (index != NULL)
+        *index = i;
+    return ret;
+}
+
+// Append n records stored back to back in recs, with one pwrite(); *first gets the first index
+static inline int rs_append_many(struct recstore *rs, const void *recs, size_t n, uint64_t *first) {
+    uint64_t i = __atomic_fetch_add(&rs->reserved, n, __ATOMIC_ACQ_REL);
+    ssize_t len = n * rs->record_size;
+    int ret = pwrite(rs->fd, recs, len, rs_offset(rs, i)) == len ? 0 : -1;
+    while (__atomic_load_n(&rs->count, __ATOMIC_ACQUIRE) != i)
+        sched_yield();
+    __atomic_store_n(&rs->count, i + n, __ATOMIC_RELEASE);
+    if (first != NULL)
+        *first = i;
+    return ret;
+}
+
+// Read records [first, first + n) into bufs[0..n), one preadv() per RS_IOV_MAX records
+static inline int rs_get_range(const struct recstore *rs, uint64_t first, size_t n, void *const *bufs) {
+    uint64_t count = __atomic_load_n(&rs->count, __ATOMIC_ACQUIRE);
+    if (first > count || n > count - first) {
+        errno = ERANGE;
+        return -1;
+    }
+    struct iovec iov[RS_IOV_MAX];
+    while (n > 0) {
+        size_t k = n < RS_IOV_MAX ? n : RS_IOV_MAX;
+        for (size_t i = 0; i < k; i++) {
+            iov[i].iov_base = bufs[i];
+            iov[i].iov_len = rs->record_size;
+        }
+        ssize_t want = k * rs->record_size;
+        ssize_t got = preadv(rs->fd, iov, k, rs_offset(rs, first));
+        if (got != want) {
+            if (got >= 0)
+                errno = EIO;
+            return -1;
+        }
+        first += k;
+        bufs += k;
+        n -= k;
+    }
+    return 0;
+}
+
+// Read records idx[0..n) into the array out (n * record_size bytes). Runs of
+// consecutive indices are fetched with one preadv() each.
+static inline int rs_get_many(const struct recstore *rs, const uint64_t *idx, size_t n, void *out) {
+    unsigned char *dst = out;
+    void *bufs[RS_IOV_MAX];
+    size_t i = 0;
+    while (i < n) {
+        size_t run = 1;
+        while (i + run < n && run < RS_IOV_MAX && idx[i + run] == idx[i] + run)
+            run++;
+        if (run == 1) {
+            if (rs_get(rs, idx[i], dst) == -1)
+                return -1;
+        } else {
+            for (size_t k = 0; k < run; k++)
+                bufs[k] = dst + k * rs->record_size;
+            if (rs_get_range(rs, idx[i], run, bufs) == -1)
+                return -1;
+        }
+        dst += run * rs->record_size;
+        i += run;
+    }
+    return 0;
+}
+
+#endif
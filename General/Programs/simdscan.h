@@ -0,0 +1,445 @@
+/*
+ * SIMD scanning kernels for the counting programs (readwriteshell.c).
+ *
+ * Every kernel comes in three versions: AVX2, SSE2 and plain C. The
+ * vector versions are compiled with __attribute__((target(...))) so the
+ * program itself needs no -mavx2; scan_init() asks CPUID (through
+ * __builtin_cpu_supports) which one this CPU can run. All three give
+ * exactly the same counts.
+ *
+ * Letters and digits are the ASCII ranges, which is what isalpha() and
+ * isdigit() return in the default "C" locale, without a per-byte call.
+ *
+ * The wc pass counts lines, words and UTF-8 code points together. Words
+ * follow coreutils wc in the C locale: whitespace (\t\n\v\f\r and ' ')
+ * ends a word, a printable byte (0x21-0x7e) starts one, and every other
+ * byte leaves the state unchanged. Code points are the bytes that are not
+ * UTF-8 continuation bytes (10xxxxxx), i.e. wc -m on valid UTF-8.
+ *
+ * scan_skip_lines() finds the end of the k-th line: the vector versions
+ * turn 64 bytes at a time into a newline bit mask and only look at single
+ * bits in the block where the count runs out (lineindex.c).
+ *
+ * scan_find() is a substring search (fsearch.c): a vector compare of the
+ * needle's first byte at p+i and its last byte at p+i+m-1 leaves few
+ * candidates, and only those are checked with memcmp().
+ *
+ * The byte histogram has no useful vector form; it is a scalar kernel that
+ * spreads consecutive bytes over four sub-histograms so that runs of the
+ * same byte do not serialise on one counter's store-to-load forwarding.
+ */
+#ifndef SIMDSCAN_H
+#define SIMDSCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86 1
+#endif
+
+enum { SCAN_SCALAR, SCAN_SSE2, SCAN_AVX2 };
+
+static const char *scan_names[] = {"scalar", "sse2", "avx2"};
+static int scan_level = SCAN_SCALAR;
+
+// Running state of the wc pass. in_word carries over from call to call, so
+// input can be fed in pieces of any size. first_sig is the class of the
+// first non-neutral byte seen (-1 none yet, 0 space, 1 printable); it lets
+// scan_wc_merge() stitch independently counted chunks back together.
+struct scan_wc {
+    uint64_t lines, words, utf8;
+    int in_word;
+    int first_sig;
+};
+
+#define SCAN_WC_INIT {0, 0, 0, 0, -1}
+
+static inline int scan_is_letter(unsigned char c) {
+    return (unsigned char)((c | 0x20) - 'a') < 26;
+}
+
+static inline int scan_is_digit(unsigned char c) {
+    return (unsigned char)(c - '0') < 10;
+}
+
+static void classify_scalar(const unsigned char *p, size_t n, uint64_t *letters, uint64_t *digits) {
+    uint64_t l = 0, d = 0;
+    for (size_t i = 0; i < n; i++) {
+        l += scan_is_letter(p[i]);
+        d += scan_is_digit(p[i]);
+    }
+    *letters += l;
+    *digits += d;
+}
+
+// 0: neutral, 1: whitespace, 2: printable
+static inline int scan_wc_class(unsigned char c) {
+    if (c == ' ' || (unsigned char)(c - '\t') < 5)
+        return 1;
+    return (unsigned char)(c - '!') < 94 ? 2 : 0;
+}
+
+static void wc_scalar(const unsigned char *p, size_t n, struct scan_wc *w) {
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = p[i];
+        int cls = scan_wc_class(c);
+        w->lines += c == '\n';
+        w->utf8 += (c & 0xc0) != 0x80;
+        if (cls == 0)
+            continue;
+        if (w->first_sig < 0)
+            w->first_sig = cls == 2;
+        w->words += cls == 2 && !w->in_word;
+        w->in_word = cls == 2;
+    }
+}
+
+// Fold the class masks of 64 consecutive bytes (bit i = byte i) into *w
+static inline void wc_masks(struct scan_wc *w, uint64_t sp, uint64_t pr, uint64_t nl, uint64_t cont) {
+    uint64_t sig = sp | pr, neutral = ~sig;
+    if (w->first_sig < 0 && sig != 0)
+        w->first_sig = (pr >> __builtin_ctzll(sig)) & 1;
+    // Neutral bytes take the state of the last significant byte before them:
+    // seed the first neutral byte after a space, then let the carry of an
+    // addition run through the rest of that neutral run.
+    uint64_t seed = ((sp << 1) | (uint64_t)!w->in_word) & neutral;
+    uint64_t spacey = sp | (((neutral + seed) ^ neutral) & neutral);
+    uint64_t starts = pr & ((spacey << 1) | (uint64_t)!w->in_word);
+    w->words += __builtin_popcountll(starts);
+    w->in_word = !(spacey >> 63);
+    w->lines += __builtin_popcountll(nl);
+    w->utf8 += 64 - __builtin_popcountll(cont);
+}
+
+// Past the k-th '\n' of p[0..n): see scan_skip_lines()
+static size_t skip_lines_scalar(const unsigned char *p, size_t n, uint64_t *k) {
+    const unsigned char *q = p, *end = p + n;
+    while (*k > 0 && (q = memchr(q, '\n', end - q)) != NULL) {
+        q++;
+        if (--*k == 0)
+            return q - p;
+    }
+    return SIZE_MAX;
+}
+
+// Within one block's newline mask: done if the k-th set bit is here, else take them all off k
+static inline size_t skip_lines_mask(uint64_t nl, size_t i, uint64_t *k) {
+    uint64_t c = __builtin_popcountll(nl);
+    if (c < *k) {
+        *k -= c;
+        return SIZE_MAX;
+    }
+    while (--*k > 0)
+        nl &= nl - 1; // drop the lowest set bit
+    return i + __builtin_ctzll(nl) + 1;
+}
+
+// First needle[0..m) in p[0..n) (m >= 1): see scan_find()
+static size_t find_scalar(const unsigned char *p, size_t n, const unsigned char *needle, size_t m) {
+    if (m > n)
+        return SIZE_MAX;
+    const unsigned char *q = p, *last = p + n - m;
+    while (q <= last && (q = memchr(q, needle[0], last - q + 1)) != NULL) {
+        if (memcmp(q + 1, needle + 1, m - 1) == 0)
+            return q - p;
+        q++;
+    }
+    return SIZE_MAX;
+}
+
+#ifdef SCAN_X86
+// x in [lo, lo+span] as a byte mask: (x - lo) <= span, unsigned, via min
+__attribute__((target("sse2")))
+static inline int range_mask_sse2(__m128i x, char lo, char span) {
+    __m128i t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(span)), t));
+}
+
+__attribute__((target("sse2")))
+static void classify_sse2(const unsigned char *p, size_t n, uint64_t *letters, uint64_t *digits) {
+    const __m128i lower = _mm_set1_epi8(0x20);
+    uint64_t l = 0, d = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) { // 4 vectors -> one 64-bit mask per class
+        uint64_t lm = 0, dm = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            lm |= (uint64_t)(uint16_t)range_mask_sse2(_mm_or_si128(v, lower), 'a', 25) << (16 * k);
+            dm |= (uint64_t)(uint16_t)range_mask_sse2(v, '0', 9) << (16 * k);
+        }
+        l += __builtin_popcountll(lm);
+        d += __builtin_popcountll(dm);
+    }
+    *letters += l;
+    *digits += d;
+    classify_scalar(p + i, n - i, letters, digits);
+}
+
+__attribute__((target("sse2")))
+static void wc_sse2(const unsigned char *p, size_t n, struct scan_wc *w) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t sp = 0, pr = 0, nl = 0, cont = 0;
+        for (int k = 0; k < 4; k++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * k));
+            int s = _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' '))) | range_mask_sse2(v, '\t', 4);
+            sp |= (uint64_t)(uint16_t)s << (16 * k);
+            pr |= (uint64_t)(uint16_t)range_mask_sse2(v, '!', 93) << (16 * k);
+            nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n'))) << (16 * k);
+            // 0x80-0xbf are the signed bytes below -64
+            cont |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmplt_epi8(v, _mm_set1_epi8(-64))) << (16 * k);
+        }
+        wc_masks(w, sp, pr, nl, cont);
+    }
+    wc_scalar(p + i, n - i, w);
+}
+
+__attribute__((target("sse2")))
+static size_t skip_lines_sse2(const unsigned char *p, size_t n, uint64_t *k) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t m = 0;
+        for (int j = 0; j < 4; j++) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(p + i + 16 * j));
+            m |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * j);
+        }
+        size_t at = skip_lines_mask(m, i, k);
+        if (at != SIZE_MAX)
+            return at;
+    }
+    size_t at = skip_lines_scalar(p + i, n - i, k);
+    return at == SIZE_MAX ? at : i + at;
+}
+
+// Candidates are the positions where both the first and the last byte of the needle match
+__attribute__((target("sse2")))
+static size_t find_sse2(const unsigned char *p, size_t n, const unsigned char *needle, size_t m) {
+    if (m > n)
+        return SIZE_MAX;
+    const __m128i first = _mm_set1_epi8(needle[0]), last = _mm_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p + i + m - 1));
+        unsigned mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (m <= 2 || memcmp(p + at + 1, needle + 1, m - 2) == 0)
+                return at;
+        }
+    }
+    size_t at = find_scalar(p + i, n - i, needle, m);
+    return at == SIZE_MAX ? at : i + at;
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t range_mask_avx2(__m256i x, char lo, char span) {
+    __m256i t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(span)), t));
+}
+
+__attribute__((target("avx2,popcnt")))
+static void classify_avx2(const unsigned char *p, size_t n, uint64_t *letters, uint64_t *digits) {
+    const __m256i lower = _mm256_set1_epi8(0x20);
+    uint64_t l = 0, d = 0;
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) { // 2 vectors -> one 64-bit mask per class
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t lm = range_mask_avx2(_mm256_or_si256(a, lower), 'a', 25) |
+                      (uint64_t)range_mask_avx2(_mm256_or_si256(b, lower), 'a', 25) << 32;
+        uint64_t dm = range_mask_avx2(a, '0', 9) | (uint64_t)range_mask_avx2(b, '0', 9) << 32;
+        l += _mm_popcnt_u64(lm);
+        d += _mm_popcnt_u64(dm);
+    }
+    *letters += l;
+    *digits += d;
+    classify_scalar(p + i, n - i, letters, digits);
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t eq_mask_avx2(__m256i x, char c) {
+    return (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(c)));
+}
+
+__attribute__((target("avx2,popcnt")))
+static void wc_avx2(const unsigned char *p, size_t n, struct scan_wc *w) {
+    const __m256i below = _mm256_set1_epi8(-64);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t sp = (eq_mask_avx2(a, ' ') | range_mask_avx2(a, '\t', 4)) |
+                      (uint64_t)(eq_mask_avx2(b, ' ') | range_mask_avx2(b, '\t', 4)) << 32;
+        uint64_t pr = range_mask_avx2(a, '!', 93) | (uint64_t)range_mask_avx2(b, '!', 93) << 32;
+        uint64_t nl = eq_mask_avx2(a, '\n') | (uint64_t)eq_mask_avx2(b, '\n') << 32;
+        // 0x80-0xbf are the signed bytes below -64
+        uint64_t cont = (uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(below, a)) |
+                        (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(below, b)) << 32;
+        wc_masks(w, sp, pr, nl, cont);
+    }
+    wc_scalar(p + i, n - i, w);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t skip_lines_avx2(const unsigned char *p, size_t n, uint64_t *k) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + 32));
+        uint64_t m = eq_mask_avx2(a, '\n') | (uint64_t)eq_mask_avx2(b, '\n') << 32;
+        size_t at = skip_lines_mask(m, i, k);
+        if (at != SIZE_MAX)
+            return at;
+    }
+    size_t at = skip_lines_scalar(p + i, n - i, k);
+    return at == SIZE_MAX ? at : i + at;
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const unsigned char *p, size_t n, const unsigned char *needle, size_t m) {
+    if (m > n)
+        return SIZE_MAX;
+    const __m256i first = _mm256_set1_epi8(needle[0]), last = _mm256_set1_epi8(needle[m - 1]);
+    size_t i = 0;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(p + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(p + i + m - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                              _mm256_cmpeq_epi8(b, last)));
+        for (; mask != 0; mask &= mask - 1) {
+            size_t at = i + __builtin_ctz(mask);
+            if (m <= 2 || memcmp(p + at + 1, needle + 1, m - 2) == 0)
+                return at;
+        }
+    }
+    size_t at = find_scalar(p + i, n - i, needle, m);
+    return at == SIZE_MAX ? at : i + at;
+}
+#endif
+
+// Pick the widest kernel this CPU supports, or the one named (NULL = best).
+// Returns -1 if the named kernel is unknown or not supported here.
+static inline int scan_init(const char *name) {
+    int best = SCAN_SCALAR;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        best = SCAN_SSE2;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+        best = SCAN_AVX2;
+#endif
+    if (name == NULL) {
+        scan_level = best;
+        return 0;
+    }
+    for (int k = SCAN_SCALAR; k <= best; k++) {
+        if (strcmp(name, scan_names[k]) == 0) {
+            scan_level = k;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Count ASCII letters and digits in p[0..n), adding to *letters and *digits
+static inline void scan_classify(const unsigned char *p, size_t n, uint64_t *letters, uint64_t *digits) {
+#ifdef SCAN_X86
+    if (scan_level == SCAN_AVX2) {
+        classify_avx2(p, n, letters, digits);
+        return;
+    }
+    if (scan_level == SCAN_SSE2) {
+        classify_sse2(p, n, letters, digits);
+        return;
+    }
+#endif
+    classify_scalar(p, n, letters, digits);
+}
+
+// Add the byte frequencies of p[0..n) to hist[256]
+static inline void scan_histogram(const unsigned char *p, size_t n, uint64_t hist[256]) {
+    uint32_t sub[4][256]; // 4 KiB, stays in L1
+    while (n > 0) {
+        // Fold into 64 bits often enough that no 32-bit sub-counter can wrap
+        size_t block = n < ((size_t)1 << 31) ? n : ((size_t)1 << 31);
+        size_t i = 0;
+        memset(sub, 0, sizeof(sub));
+        for (; i + 8 <= block; i += 8) {
+            uint64_t w;
+            memcpy(&w, p + i, 8);
+            sub[0][w & 0xff]++;
+            sub[1][(w >> 8) & 0xff]++;
+            sub[2][(w >> 16) & 0xff]++;
+            sub[3][(w >> 24) & 0xff]++;
+            sub[0][(w >> 32) & 0xff]++;
+            sub[1][(w >> 40) & 0xff]++;
+            sub[2][(w >> 48) & 0xff]++;
+            sub[3][w >> 56]++;
+        }
+        for (; i < block; i++)
+            sub[0][p[i]]++;
+        for (int b = 0; b < 256; b++)
+            hist[b] += (uint64_t)sub[0][b] + sub[1][b] + sub[2][b] + sub[3][b];
+        p += block;
+        n -= block;
+    }
+}
+
+// Lines, words and UTF-8 code points of p[0..n), continuing from *w
+static inline void scan_wc(const unsigned char *p, size_t n, struct scan_wc *w) {
+#ifdef SCAN_X86
+    if (scan_level == SCAN_AVX2) {
+        wc_avx2(p, n, w);
+        return;
+    }
+    if (scan_level == SCAN_SSE2) {
+        wc_sse2(p, n, w);
+        return;
+    }
+#endif
+    wc_scalar(p, n, w);
+}
+
+// Offset just past the k-th '\n' of p[0..n) (*k >= 1), with *k set to 0. If there are
+// fewer, returns SIZE_MAX and takes the number seen off *k, so the search can go on in
+// the next piece of input.
+static inline size_t scan_skip_lines(const unsigned char *p, size_t n, uint64_t *k) {
+#ifdef SCAN_X86
+    if (scan_level == SCAN_AVX2)
+        return skip_lines_avx2(p, n, k);
+    if (scan_level == SCAN_SSE2)
+        return skip_lines_sse2(p, n, k);
+#endif
+    return skip_lines_scalar(p, n, k);
+}
+
+// Offset of the first occurrence of needle[0..m) (m >= 1) in p[0..n), or SIZE_MAX
+static inline size_t scan_find(const unsigned char *p, size_t n, const unsigned char *needle, size_t m) {
+#ifdef SCAN_X86
+    if (m > 1 && scan_level == SCAN_AVX2)
+        return find_avx2(p, n, needle, m);
+    if (m > 1 && scan_level == SCAN_SSE2)
+        return find_sse2(p, n, needle, m);
+#endif
+    return find_scalar(p, n, needle, m); // one byte: memchr is already vectorised
+}
+
+// Append the counts of the input that directly follows what *acc covers.
+// *next must have been counted from a fresh SCAN_WC_INIT state.
+static inline void scan_wc_merge(struct scan_wc *acc, const struct scan_wc *next) {
+    acc->lines += next->lines;
+    acc->utf8 += next->utf8;
+    // next assumed it started outside a word; undo that if acc ends inside one
+    acc->words += next->words - (next->first_sig == 1 && acc->in_word);
+    if (acc->first_sig < 0)
+        acc->first_sig = next->first_sig;
+    if (next->first_sig >= 0)
+        acc->in_word = next->in_word;
+}
+
+#endif
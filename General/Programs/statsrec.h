@@ -0,0 +1,55 @@
+/*
+ * Binary stats records written by readwriteshell -b and read by statsagg.
+ *
+ * One record per counted file, 128 bytes, fixed layout, native byte order
+ * (little-endian on every machine we run on). Writers append whole
+ * records to a shared file opened with O_APPEND. Each write() is a whole
+ * number of records, and the kernel places each O_APPEND write atomically
+ * at the end of the file. So any number of concurrent counters can append
+ * without a lock and records never interleave mid-way.
+ *
+ * The counters sit in the second 64-byte half of the record, so a reader
+ * that mmaps the file can sum them with two 256-bit adds per record.
+ * Counters a mode did not produce are 0 and the flags say which are valid.
+ * A new layout gets a new version; readers skip versions they do not know.
+ */
+#ifndef STATSREC_H
+#define STATSREC_H
+
+#include <stdint.h>
+
+#define STATSREC_MAGIC 0x52535752   // "RWSR"
+#define STATSREC_VERSION 1
+
+// flags
+#define STATSREC_CLASSIFY 0x1 // letters and numbers are valid
+#define STATSREC_WC 0x2       // lines, words and utf8 are valid
+
+enum {
+    STATSREC_BYTES,
+    STATSREC_LETTERS,
+    STATSREC_NUMBERS,
+    STATSREC_LINES,
+    STATSREC_WORDS,
+    STATSREC_UTF8,
+    STATSREC_NCOUNTERS = 8 // two spare slots keep the block 64 bytes
+};
+
+struct statsrec {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t dev, ino;      // file identity
+    uint64_t size;          // st_size when counted
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t reserved;
+    int64_t counted_at;     // CLOCK_REALTIME nanoseconds when the record was made
+    uint64_t pad;
+    uint64_t counters[STATSREC_NCOUNTERS]; // offset 64
+} __attribute__((aligned(64)));
+
+_Static_assert(sizeof(struct statsrec) == 128, "statsrec layout changed");
+_Static_assert(__builtin_offsetof(struct statsrec, counters) == 64, "statsrec counters moved");
+
+#endif
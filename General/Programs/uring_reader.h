@@ -0,0 +1,325 @@
+/*
+ * Streaming file reader on io_uring, for the counting programs
+ * (readwriteshell.c, Practice/read_call_tillend_inchunks.c).
+ *
+ * A plain read() loop has one request outstanding: while the program
+ * counts a buffer, the device sits idle, and while the device works, the
+ * CPU waits. The reader here keeps 'depth' reads in flight at increasing
+ * offsets, each into its own page-aligned buffer, and hands completed
+ * buffers back strictly in file order. A buffer goes back to the kernel
+ * with the next offset as soon as the caller asks for the following one.
+ *
+ * There is no liburing dependency. The bottom half is a minimal ring layer
+ * over the three raw system calls (io_uring_setup, io_uring_enter,
+ * io_uring_register). The buffers are registered once, so the reads are
+ * IORING_OP_READ_FIXED and the kernel does not pin and unpin pages for
+ * every request. If registration is refused (RLIMIT_MEMLOCK), plain
+ * IORING_OP_READ is used instead.
+ *
+ *     struct ur_reader r;
+ *     if (ur_init(&r, 8, 1 << 18) == 0) {
+ *         ur_start(&r, fd, 0, -1);                  // whole file
+ *         while ((n = ur_next(&r, &p)) > 0)
+ *             consume(p, n);                        // p valid until the next call
+ *         ur_stop(&r);
+ *         ur_free(&r);
+ *     }
+ *
+ * One reader serves one file at a time but can be reused for many, so a
+ * worker thread sets up its ring once. The input has to be seekable
+ * (regular file or block device); pipes still need read().
+ */
+#ifndef URING_READER_H
+#define URING_READER_H
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define UR_MAX_DEPTH 256
+#define UR_ALIGN 4096 // buffer alignment, enough for O_DIRECT too
+
+// ---- Ring layer ----
+
+struct uring {
+    int fd;
+    unsigned *sq_head, *sq_tail, *sq_mask;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    unsigned sqe_tail; // next free SQE; published to *sq_tail by uring_submit()
+    void *sq_ring, *cq_ring;
+    size_t sq_ring_size, cq_ring_size, sqes_size;
+};
+
+static inline void uring_exit(struct uring *u) {
+    if (u->sqes != NULL && u->sqes != MAP_FAILED)
+        munmap(u->sqes, u->sqes_size);
+    if (u->cq_ring != NULL && u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring)
+        munmap(u->cq_ring, u->cq_ring_size);
+    if (u->sq_ring != NULL && u->sq_ring != MAP_FAILED)
+        munmap(u->sq_ring, u->sq_ring_size);
+    if (u->fd >= 0)
+        close(u->fd);
+    u->fd = -1;
+}
+
+// Create a ring with at least 'entries' submission slots; -1 with errno set
+// if io_uring is unavailable (old kernel, disabled by sysctl or seccomp)
+static inline int uring_init(struct uring *u, unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    u->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (u->fd < 0)
+        return -1;
+
+    u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0; // both rings in one mapping
+    if (single && u->cq_ring_size > u->sq_ring_size)
+        u->sq_ring_size = u->cq_ring_size;
+    u->sq_ring = mmap(NULL, u->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = single ? u->sq_ring
+                        : mmap(NULL, u->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                               u->fd, IORING_OFF_CQ_RING);
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                   IORING_OFF_SQES);
+    if (u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED || u->sqes == MAP_FAILED) {
+        int err = errno;
+        uring_exit(u);
+        errno = err;
+        return -1;
+    }
+
+    char *sq = u->sq_ring, *cq = u->cq_ring;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    // SQE i always sits in array slot i, so the indirection array is filled once
+    unsigned *array = (unsigned *)(sq + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++)
+        array[i] = i;
+    u->sqe_tail = *u->sq_tail;
+    return 0;
+}
+
+// A zeroed SQE to fill in. The caller never has more in flight than the ring holds.
+static inline struct io_uring_sqe *uring_get_sqe(struct uring *u) {
+    struct io_uring_sqe *sqe = &u->sqes[u->sqe_tail++ & *u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+// Hand the new SQEs to the kernel and, if wait_nr > 0, sleep until that many completions exist
+static inline int uring_submit(struct uring *u, unsigned wait_nr) {
+    __atomic_store_n(u->sq_tail, u->sqe_tail, __ATOMIC_RELEASE);
+    unsigned todo = u->sqe_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (todo == 0 && wait_nr == 0)
+        return 0;
+    for (;;) {
+        long ret = syscall(__NR_io_uring_enter, u->fd, todo, wait_nr,
+                           wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (ret >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -1;
+    }
+}
+
+// Oldest unconsumed completion, or NULL; release it with uring_cqe_seen()
+static inline struct io_uring_cqe *uring_peek_cqe(struct uring *u) {
+    unsigned head = *u->cq_head;
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &u->cqes[head & *u->cq_mask];
+}
+
+static inline void uring_cqe_seen(struct uring *u) {
+    __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+static inline int uring_register_buffers(struct uring *u, const struct iovec *iov, unsigned n) {
+    return syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, n) < 0 ? -1 : 0;
+}
+
+// ---- Streaming reader ----
+
+enum { UR_IDLE, UR_BUSY, UR_DONE };
+
+struct ur_slot {
+    int state;
+    off_t off;   // file offset this buffer was read from
+    size_t len;  // bytes requested
+    ssize_t res; // bytes read, or -errno
+};
+
+struct ur_reader {
+    struct uring ring;
+    unsigned char *bufs; // depth buffers, each starting on a UR_ALIGN boundary
+    size_t buf_size;     // bytes per read
+    size_t stride;       // distance between buffers: buf_size rounded up to UR_ALIGN
+    unsigned depth;
+    int fixed;           // buffers are registered: READ_FIXED
+    int fd;
+    off_t next_off;      // offset of the next read to queue
+    off_t end;           // stop here, or -1 for end of file
+    unsigned head;       // slot to deliver next; later slots hold later offsets
+    int held;            // slot the caller is looking at, requeued on the next call
+    int eof;             // a short read was delivered: nothing after it
+    unsigned busy;       // reads in flight
+    struct ur_slot slot[UR_MAX_DEPTH];
+};
+
+// Ring, buffers and registration. Returns -1 (errno set) if io_uring cannot be used.
+static inline int ur_init(struct ur_reader *r, unsigned depth, size_t buf_size) {
+    memset(r, 0, sizeof(*r));
+    if (depth < 1)
+        depth = 1;
+    if (depth > UR_MAX_DEPTH)
+        depth = UR_MAX_DEPTH;
+    r->depth = depth;
+    r->buf_size = buf_size;
+    r->stride = (buf_size + UR_ALIGN - 1) / UR_ALIGN * UR_ALIGN;
+    r->held = -1;
+    r->fd = -1;
+    if (uring_init(&r->ring, depth) == -1)
+        return -1;
+    if (posix_memalign((void **)&r->bufs, UR_ALIGN, r->stride * depth) != 0) {
+        uring_exit(&r->ring);
+        errno = ENOMEM;
+        return -1;
+    }
+    struct iovec iov[UR_MAX_DEPTH];
+    for (unsigned i = 0; i < depth; i++) {
+        iov[i].iov_base = r->bufs + i * r->stride;
+        iov[i].iov_len = r->buf_size;
+    }
+    r->fixed = uring_register_buffers(&r->ring, iov, depth) == 0;
+    return 0;
+}
+
+// SQE for slot i's read; goes to the kernel with the next uring_submit()
+static inline void ur_issue(struct ur_reader *r, unsigned i) {
+    struct ur_slot *s = &r->slot[i];
+    struct io_uring_sqe *sqe = uring_get_sqe(&r->ring);
+    sqe->opcode = r->fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->off = s->off;
+    sqe->addr = (uint64_t)(uintptr_t)(r->bufs + i * r->stride);
+    sqe->len = s->len;
+    sqe->buf_index = r->fixed ? i : 0;
+    sqe->user_data = i;
+}
+
+// Queue slot i for the next piece of the range, or leave it idle if there is none
+static inline void ur_queue(struct ur_reader *r, unsigned i) {
+    struct ur_slot *s = &r->slot[i];
+    if (r->eof || (r->end >= 0 && r->next_off >= r->end)) {
+        s->state = UR_IDLE;
+        return;
+    }
+    s->off = r->next_off;
+    s->len = r->buf_size;
+    if (r->end >= 0 && (off_t)s->len > r->end - s->off)
+        s->len = r->end - s->off;
+    r->next_off += s->len;
+    s->state = UR_BUSY;
+    r->busy++;
+    ur_issue(r, i);
+}
+
+// Start reading bytes [start, end) of fd (end -1: to end of file)
+static inline void ur_start(struct ur_reader *r, int fd, off_t start, off_t end) {
+    r->fd = fd;
+    r->next_off = start;
+    r->end = end;
+    r->head = 0;
+    r->held = -1;
+    r->eof = 0;
+    for (unsigned i = 0; i < r->depth; i++)
+        ur_queue(r, i);
+}
+
+// Move finished reads from the completion ring into their slots
+static inline void ur_reap(struct ur_reader *r) {
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(&r->ring)) != NULL) {
+        unsigned i = cqe->user_data;
+        int res = cqe->res;
+        uring_cqe_seen(&r->ring);
+        if (res == -EAGAIN || res == -EINTR) {
+            ur_issue(r, i); // transient: issue the same read again
+            continue;
+        }
+        r->slot[i].res = res;
+        r->slot[i].state = UR_DONE;
+        r->busy--;
+    }
+}
+
+// Next buffer in file order: its length, 0 at the end, -1 with errno on error.
+// *data stays valid until the next call.
+static inline ssize_t ur_next(struct ur_reader *r, const unsigned char **data) {
+    if (r->held >= 0) {
+        ur_queue(r, r->held); // the caller is done with it: reuse it for the next offset
+        r->held = -1;
+    }
+    struct ur_slot *s = &r->slot[r->head];
+    if (r->eof || s->state == UR_IDLE)
+        return 0;
+    ur_reap(r);
+    while (s->state != UR_DONE) {
+        if (uring_submit(&r->ring, 1) == -1)
+            return -1;
+        ur_reap(r);
+    }
+    uring_submit(&r->ring, 0); // reads requeued by ur_reap()
+    if (s->res < 0) {
+        errno = -s->res;
+        s->state = UR_IDLE;
+        r->eof = 1;
+        return -1;
+    }
+    if ((size_t)s->res < s->len)
+        r->eof = 1; // end of file: later slots read past it
+    r->held = r->head;
+    r->head = (r->head + 1) % r->depth;
+    *data = r->bufs + r->held * r->stride;
+    return s->res;
+}
+
+// Finish with the current file: wait for the reads still in flight
+static inline void ur_stop(struct ur_reader *r) {
+    int err = errno;
+    r->eof = 1;
+    while (r->busy > 0 && uring_submit(&r->ring, 1) == 0)
+        ur_reap(r);
+    for (unsigned i = 0; i < r->depth; i++)
+        r->slot[i].state = UR_IDLE;
+    r->held = -1;
+    r->fd = -1;
+    errno = err;
+}
+
+static inline void ur_free(struct ur_reader *r) {
+    ur_stop(r);
+    uring_exit(&r->ring);
+    free(r->bufs);
+    r->bufs = NULL;
+}
+
+#endif
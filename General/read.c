@@ -1,7 +1,15 @@
 #include<unistd.h>
+#include "Programs/bufio.h"
 int main()
 {
 char buff[20];
-read(0,buff,10);//read 10 bytes from standard input device(keyboard), store in buffer (buff)
-write(1,buff,3);//print 10 bytes from the buffer on the screen
-}
\ No newline at end of file
+int n;
+struct bufio in,out;
+bio_init(&in,0,0);//standard input(keyboard), read a whole buffer at a time
+bio_init(&out,1,0);//standard output(screen)
+n=bio_read(&in,buff,10);//up to 10 bytes from standard input (one line from a keyboard), store in buffer (buff)
+bio_write(&out,buff,n<3?(n<0?0:n):3);//print 3 bytes from the buffer on the screen
+bio_flush(&out);
+bio_free(&in);
+bio_free(&out);
+}
@@ -4,27 +4,74 @@
 #include<fcntl.h>
 #include<malloc.h>
 #include<unistd.h>
+#include "../General/Programs/uring_reader.h"
+#include "../General/Programs/bufio.h"
 
-int main() {
+#define CHUNK 99    // bytes per chunk, same in both modes
+
+// Build: gcc read_call_tillend_inchunks.c
+// Usage: ./a.out [-u [depth]] [file]      (file defaults to xyz)
+//   -u  read through io_uring with 'depth' chunks in flight (default 8)
+// Without -u the file is read through bufio.h: one read() fills 256 KiB ($BUFIO_SIZE),
+// and the 99-byte chunks are taken from memory. Output is buffered the same way.
+
+int main(int argc, char *argv[]) {
     int fd;
     ssize_t sz;
     char buf[100] = {0};
+    const char *file = "xyz";
+    int use_uring = 0;
+    unsigned depth = 8;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-u") == 0) {
+            use_uring = 1;
+            if(i + 1 < argc && atoi(argv[i + 1]) > 0)
+                depth = atoi(argv[++i]);
+        } else {
+            file = argv[i];
+        }
+    }
 
-    fd=open("xyz",O_RDONLY);
+    fd=open(file,O_RDONLY);
 
     if(fd < 0) {
         perror("Error Opening File");
         exit(1);
     }
 
-    while((sz = read(fd,buf,sizeof(buf) - 1))>0){  // reads till the end.
-        buf[sz] = '\0';                            // for termination of string.
-        printf(" Chunk read \n %s", buf);
+    struct ur_reader r;
+    struct bufio in, out;
+    bio_init(&out, 1, 0);
+    if(use_uring && ur_init(&r, depth, CHUNK) == -1) {
+        perror("io_uring unavailable, using read()");
+        use_uring = 0;
+    }
+
+    if(use_uring) {
+        // Same chunks, but the next 'depth' reads are already queued while one is printed
+        const unsigned char *p;
+        ur_start(&r, fd, 0, -1);
+        while((sz = ur_next(&r, &p)) > 0) {
+            memcpy(buf, p, sz);
+            buf[sz] = '\0';
+            bio_printf(&out, " Chunk read \n %s", buf);
+        }
+        ur_free(&r);
+    } else {
+        bio_init(&in, fd, 0);
+        while((sz = bio_read_exact(&in,buf,CHUNK))>0){  // reads till the end.
+            buf[sz] = '\0';                            // for termination of string.
+            bio_printf(&out, " Chunk read \n %s", buf);
+        }
+        bio_free(&in);
     }
+    bio_flush(&out);
+    bio_free(&out);
     if(sz < 0) {
-        perror("error reading list"); 
+        perror("error reading list");
         exit(1);
     }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -1,13 +1,13 @@
 #include <stdio.h>
 #include <unistd.h> // for write syscall
 #include <string.h>
+#include "../General/Programs/bufio.h"
 
 int main(){
-    size_t length;
-    int lenString;
-    char buf[100]; // created buffer array
-    strncpy(buf,"Hello! I am Printed through the use of a system call.",99); // passed the string to that buffer array
-    lenString = strlen(buf);
-    length = write(1,buf,lenString);   // write sys call to print it to the terminal
+    struct bufio out;
+    bio_init(&out, 1, 0); // output buffer on file descriptor 1 (the terminal)
+    bio_puts(&out, "Hello! I am Printed through the use of a system call."); // copied into the buffer, no syscall yet
+    bio_flush(&out);   // one writev sys call prints everything buffered so far
+    bio_free(&out);
     return 0;
-}
\ No newline at end of file
+}